@@ -0,0 +1,458 @@
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "FastContainer.h"
+
+// Benchmark of FastContainer without ROOT. Every run uses fixed seeds, so two runs on the same
+// machine measure the same inputs and queries; the results are written as JSON.
+//   FastContainerBench [--max-n N] [--queries Q] [--seed S] [--distributions a,b] [--bucketings a,b] [--threads T] [--simd scalar|avx2|avx512] [--output file]
+
+namespace
+{
+
+const double lowerBound = -200.0;
+const double upperBound = 200.0;
+
+struct Options
+{
+    size_t maxN = 1000000;
+    size_t nQueries = 100000;
+    uint64_t seed = 42;
+    std::vector<std::string> distributions = {"uniform", "clustered", "zipf", "duplicates"};
+    std::vector<std::string> bucketings = {"uniform", "quantile", "learned"};
+    int maxThreads = std::max<int>(std::thread::hardware_concurrency(), 1); // scaling of the bulk queries up to it
+    std::string simd; // kernels of the cell search, the best supported ones by default
+    std::string output;
+};
+
+struct Latency
+{
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    double max = 0;
+    double throughput = 0; // queries per second in a tight loop
+    double branchMisses = -1; // per query in the tight loop, -1 without access to the counters
+    double branches = -1;
+};
+
+// Hardware counter of the calling thread, read as perf stat does. Invalid where perf events are not
+// permitted, e.g. in containers or with a high perf_event_paranoid
+class PerfCounter
+{
+private:
+    int _fd = -1;
+public:
+    explicit PerfCounter(uint64_t config);
+    PerfCounter(const PerfCounter&) = delete;
+    PerfCounter& operator=(const PerfCounter&) = delete;
+    ~PerfCounter() {if (_fd >= 0) ::close(_fd);};
+
+    inline bool isValid() const {return _fd >= 0;};
+    void start();
+    // events since start(), -1 if invalid
+    double stop();
+};
+
+PerfCounter::PerfCounter(uint64_t config)
+{
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    _fd = ::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void PerfCounter::start()
+{
+    if (!isValid())
+        return;
+    ::ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+    ::ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+double PerfCounter::stop()
+{
+    if (!isValid())
+        return -1;
+    ::ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t count = 0;
+    return ::read(_fd, &count, sizeof(count)) == sizeof(count) ? double(count) : -1;
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+Bucketing getBucketing(const std::string& name)
+{
+    if (name == "uniform")
+        return Bucketing::Uniform;
+    if (name == "quantile")
+        return Bucketing::Quantile;
+    if (name == "learned")
+        return Bucketing::Learned;
+    throw std::invalid_argument("Unknown bucketing " + name);
+}
+
+const std::vector<std::string> simdNames = {"scalar", "avx2", "avx512"};
+
+SimdLevel getSimdLevel(const std::string& name)
+{
+    const auto it = std::find(simdNames.begin(), simdNames.end(), name);
+    if (it == simdNames.end())
+        throw std::invalid_argument("Unknown simd level " + name);
+    return SimdLevel(it - simdNames.begin());
+}
+
+// Draws values of one distribution, all inside of [lowerBound, upperBound]:
+//   uniform    - uniform over the whole range
+//   clustered  - 16 narrow gaussian clusters
+//   zipf       - density falling as a power law from the lower bound, 2^20 zipf ranks of equal width
+//   duplicates - 1024 distinct values, every one repeated many times
+class Generator
+{
+private:
+    std::mt19937_64 _gen;
+    std::uniform_real_distribution<> _udist{lowerBound, upperBound};
+    std::uniform_real_distribution<> _unit{0.0, 1.0};
+    std::vector<double> _centers;
+    std::vector<double> _zipfCdf;
+    std::vector<double> _distinct;
+public:
+    Generator(const std::string& distribution, uint64_t seed);
+    double operator()();
+};
+
+Generator::Generator(const std::string& distribution, uint64_t seed):
+    _gen(seed)
+{
+    // the shape parameters are drawn from a fixed seed, so inputs and queries share them
+    std::mt19937_64 shapeGen(1);
+    std::uniform_real_distribution<> shape(lowerBound + 20, upperBound - 20);
+    if (distribution == "clustered")
+    {
+        _centers.resize(16);
+        for (auto& center: _centers)
+            center = shape(shapeGen);
+    }
+    else if (distribution == "zipf")
+    {
+        const double s = 1.2;
+        _zipfCdf.resize(1 << 20);
+        double sum = 0;
+        for (size_t rank = 0; rank < _zipfCdf.size(); ++rank)
+        {
+            sum += std::pow(rank + 1, -s);
+            _zipfCdf[rank] = sum;
+        }
+        for (auto& cdf: _zipfCdf)
+            cdf /= sum;
+    }
+    else if (distribution == "duplicates")
+    {
+        _distinct.resize(1024);
+        for (auto& value: _distinct)
+            value = shape(shapeGen);
+    }
+    else if (distribution != "uniform")
+        throw std::invalid_argument("Unknown distribution " + distribution);
+}
+
+double Generator::operator()()
+{
+    if (!_centers.empty())
+    {
+        std::normal_distribution<> ndist(_centers[_gen() % _centers.size()], 0.5);
+        return std::clamp(ndist(_gen), lowerBound, upperBound);
+    }
+    if (!_zipfCdf.empty())
+    {
+        const size_t rank = std::lower_bound(_zipfCdf.begin(), _zipfCdf.end(), _unit(_gen)) - _zipfCdf.begin();
+        const double width = (upperBound - lowerBound) / _zipfCdf.size();
+        return std::min(lowerBound + (std::min(rank, _zipfCdf.size() - 1) + _unit(_gen)) * width, upperBound);
+    }
+    if (!_distinct.empty())
+        return _distinct[_gen() % _distinct.size()];
+    return _udist(_gen);
+}
+
+// latency percentiles of single timed queries, the throughput of the same queries run back to back
+template <typename Query>
+Latency measure(size_t nQueries, Query query)
+{
+    Latency latency;
+    std::vector<double> times(nQueries);
+    size_t checksum = 0;
+    for (size_t idx = 0; idx < nQueries; ++idx)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        checksum += query(idx);
+        const auto stop = std::chrono::steady_clock::now();
+        times[idx] = std::chrono::duration<double, std::nano>(stop - start).count();
+    }
+
+    PerfCounter branchMisses(PERF_COUNT_HW_BRANCH_MISSES);
+    PerfCounter branches(PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+    branchMisses.start();
+    branches.start();
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t idx = 0; idx < nQueries; ++idx)
+        checksum += query(idx);
+    const auto stop = std::chrono::steady_clock::now();
+    const double nBranches = branches.stop();
+    const double nBranchMisses = branchMisses.stop();
+    latency.throughput = nQueries / std::chrono::duration<double>(stop - start).count();
+    latency.branchMisses = nBranchMisses < 0 ? -1 : nBranchMisses / nQueries;
+    latency.branches = nBranches < 0 ? -1 : nBranches / nQueries;
+
+    std::sort(times.begin(), times.end());
+    auto percentile = [&times](double fraction){ return times[std::min<size_t>(fraction * times.size(), times.size() - 1)]; };
+    latency.p50 = percentile(0.5);
+    latency.p90 = percentile(0.9);
+    latency.p99 = percentile(0.99);
+    latency.p999 = percentile(0.999);
+    latency.max = times.back();
+
+    // keeps the queries from being optimised away
+    if (checksum == size_t(-1))
+        std::cerr << "checksum " << checksum << std::endl;
+    return latency;
+}
+
+void writeLatency(std::ostream& out, const std::string& name, const Latency& latency)
+{
+    out << "\"" << name << "\": {\"p50_ns\": " << latency.p50 << ", \"p90_ns\": " << latency.p90
+        << ", \"p99_ns\": " << latency.p99 << ", \"p999_ns\": " << latency.p999 << ", \"max_ns\": " << latency.max
+        << ", \"throughput_qps\": " << latency.throughput;
+    // null where the hardware counters are not available
+    if (latency.branchMisses < 0)
+        out << ", \"branch_misses_per_query\": null, \"branches_per_query\": null}";
+    else
+        out << ", \"branch_misses_per_query\": " << latency.branchMisses << ", \"branches_per_query\": " << latency.branches << "}";
+}
+
+// Throughput of the bulk queries on pools of 1, 2, 4, ... up to maxThreads threads
+void writeScaling(std::ostream& out, const FastContainer<double>& fc, const std::vector<double>& queries, double width, int maxThreads)
+{
+    std::vector<FastContainer<double>::Interval> intervals;
+    intervals.reserve(queries.size());
+    for (const double query: queries)
+        intervals.emplace_back(query, std::min(query + width, upperBound));
+
+    std::vector<int> nThreads;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        nThreads.push_back(threads);
+    nThreads.push_back(maxThreads);
+
+    out << "\"scaling\": [";
+    std::vector<int> ids;
+    std::vector<FastContainer<double>::Range> ranges;
+    for (size_t idx = 0; idx < nThreads.size(); ++idx)
+    {
+        ThreadPool pool(nThreads[idx]);
+        auto start = std::chrono::steady_clock::now();
+        fc.getClosestIds(queries, ids, pool);
+        auto stop = std::chrono::steady_clock::now();
+        const double closest = queries.size() / std::chrono::duration<double>(stop - start).count();
+
+        start = std::chrono::steady_clock::now();
+        fc.getIdsInRanges(intervals, ranges, pool);
+        stop = std::chrono::steady_clock::now();
+        const double range = queries.size() / std::chrono::duration<double>(stop - start).count();
+
+        out << (idx ? ", " : "") << "{\"threads\": " << nThreads[idx] << ", \"closest_qps\": " << closest << ", \"range_qps\": " << range << "}";
+    }
+    out << "]";
+}
+
+void runCase(std::ostream& out, const Options& options, const std::string& distribution, const std::string& bucketing, size_t N)
+{
+    std::cerr << distribution << " " << bucketing << " " << N << std::endl;
+    out << "    {\"distribution\": \"" << distribution << "\", \"bucketing\": \"" << bucketing << "\", \"n\": " << N;
+
+    // the same seeds for every bucketing, so the bucketings see the same data
+    Generator dataGen(distribution, options.seed);
+    std::vector<std::pair<int, double>> input;
+    input.reserve(N);
+    for (size_t idx = 0; idx < N; ++idx)
+        input.emplace_back(idx, dataGen());
+
+    // queries follow the data, the ranges hold about 16 points for uniform data
+    Generator queryGen(distribution, options.seed + 1);
+    std::vector<double> queries(options.nQueries);
+    for (auto& query: queries)
+        query = queryGen();
+    const double width = (upperBound - lowerBound) * 16 / N;
+
+    try
+    {
+        FastContainer<double> fc(lowerBound, upperBound, getBucketing(bucketing));
+        const auto start = std::chrono::steady_clock::now();
+        fc.set(input);
+        const auto stop = std::chrono::steady_clock::now();
+
+        size_t nIds = 0;
+        for (const double query: queries)
+            nIds += fc.countInRange(query, std::min(query + width, upperBound));
+
+        const Latency closest = measure(queries.size(), [&](size_t idx){ return size_t(*fc.getClosestId(queries[idx]).first); });
+        const Latency checked = measure(queries.size(), [&](size_t idx){ return size_t(*fc.getClosestIdChecked(queries[idx]).first); });
+        fc.setKernel(true);
+        const bool kernelActive = fc.hasKernel();
+        const Latency kernel = measure(queries.size(), [&](size_t idx){ return size_t(*fc.getClosestId(queries[idx]).first); });
+        fc.setKernel(false);
+        const Latency range = measure(queries.size(), [&](size_t idx){
+            const auto [first, last] = fc.getIdsInRange(queries[idx], std::min(queries[idx] + width, upperBound));
+            return size_t(last - first);
+        });
+
+        const ContainerStats stats = fc.getStats();
+        out << ", \"build_ms\": " << std::chrono::duration<double, std::milli>(stop - start).count()
+            << ", \"bytes_per_point\": " << double(stats.memoryUsage) / N << ", \"cells\": " << stats.nCells
+            << ", \"empty_cells\": " << stats.occupancy[0] << ", \"longest_empty_gap\": " << stats.longestEmptyGap
+            << ", \"longest_duplicate_run\": " << stats.longestDuplicateRun
+            << ", \"range_mean_ids\": " << double(nIds) / queries.size() << ", ";
+        writeLatency(out, "closest", closest);
+        out << ", ";
+        writeLatency(out, "closest_checked", checked);
+        out << ", ";
+        writeLatency(out, "closest_kernel", kernel);
+        out << ", \"kernel_active\": " << (kernelActive ? "true" : "false") << ", ";
+        writeLatency(out, "range", range);
+        out << ", ";
+        writeScaling(out, fc, queries, width, options.maxThreads);
+#ifdef FASTCONTAINER_COUNTERS
+        const QueryCounters counters = fc.getQueryCounters();
+        out << ", \"counters\": {\"empty_cell\": " << counters.emptyCell << ", \"left_of_cell\": " << counters.leftOfCell
+            << ", \"right_of_cell\": " << counters.rightOfCell << ", \"in_cell\": " << counters.inCell << "}";
+#endif
+    }
+    catch (const std::exception& error)
+    {
+        // e.g. uniform bucketing of very dense clusters running out of memory
+        out << ", \"error\": \"" << error.what() << "\"";
+    }
+    out << "}";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        const std::string arg = argv[idx];
+        if (idx + 1 == argc)
+        {
+            std::cerr << "Usage: " << argv[0] << " [--max-n N] [--queries Q] [--seed S] [--distributions a,b] [--bucketings a,b] [--threads T] [--simd scalar|avx2|avx512] [--output file]" << std::endl;
+            return 1;
+        }
+        const std::string value = argv[++idx];
+        if (arg == "--max-n")
+            options.maxN = std::stod(value);
+        else if (arg == "--queries")
+            options.nQueries = std::max<size_t>(std::stod(value), 1);
+        else if (arg == "--seed")
+            options.seed = std::stoull(value);
+        else if (arg == "--distributions")
+            options.distributions = split(value);
+        else if (arg == "--bucketings")
+            options.bucketings = split(value);
+        else if (arg == "--threads")
+            options.maxThreads = std::max(std::stoi(value), 1);
+        else if (arg == "--simd")
+            options.simd = value;
+        else if (arg == "--output")
+            options.output = value;
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    // check the names before the first case runs
+    try
+    {
+        if (options.maxN == 0)
+            throw std::invalid_argument("Incorrect maximal size");
+        for (const auto& distribution: options.distributions)
+            Generator(distribution, options.seed);
+        for (const auto& bucketing: options.bucketings)
+            getBucketing(bucketing);
+        if (!options.simd.empty() && setSimdLevel(getSimdLevel(options.simd)) != getSimdLevel(options.simd))
+            throw std::invalid_argument("Simd level " + options.simd + " is not supported");
+    }
+    catch (const std::invalid_argument& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    // sizes by decades from 1000 up to maxN
+    std::vector<size_t> sizes;
+    for (size_t N = 1000; N < options.maxN; N *= 10)
+        sizes.push_back(N);
+    sizes.push_back(options.maxN);
+
+    std::ofstream file;
+    if (!options.output.empty())
+    {
+        file.open(options.output);
+        if (!file)
+        {
+            std::cerr << "Cannot open " << options.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = options.output.empty() ? std::cout : file;
+
+    out << "{\n  \"benchmark\": \"FastContainerBench\",\n  \"seed\": " << options.seed << ",\n  \"queries\": " << options.nQueries
+        << ",\n  \"threads\": " << options.maxThreads << ",\n  \"simd\": \"" << simdNames[int(getSimdLevel())] << "\",\n  \"results\": [\n";
+    bool first = true;
+    for (const auto& distribution: options.distributions)
+    {
+        for (const auto& bucketing: options.bucketings)
+        {
+            for (const size_t N: sizes)
+            {
+                if (!first)
+                    out << ",\n";
+                first = false;
+                runCase(out, options, distribution, bucketing, N);
+            }
+        }
+    }
+    out << "\n  ]\n}" << std::endl;
+    return 0;
+}
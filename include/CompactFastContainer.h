@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "FastContainer.h"
+#include "RadixSort.h"
+
+// Uniform bucketing as in FastContainer, stored as flat arrays instead of one FastStructure per cell:
+//   _values  - distinct values in order
+//   _runs    - position in _indices of the first id of every distinct value, the last entry is the number of ids
+//   _offsets - first distinct value of every bucket (CSR), an empty bucket costs one offset
+// The values of a bucket are contiguous, the ones after an empty bucket are the next ones in _values,
+// so a lookup reads two offsets and a few neighbouring values and needs no links to the filled buckets.
+template <typename Key, typename Id = int, int BatchSize = 5>
+class CompactFastContainer
+{
+  static_assert(std::is_arithmetic_v<Key> && !std::is_same_v<Key, bool>, "Key must be an arithmetic type");
+public:
+  using const_iterator = typename std::vector<Id>::const_iterator;
+  using Range = std::pair<const_iterator, const_iterator>;
+
+private:
+  Key _lowerBound;
+  Key _upperBound;
+  Distance<Key> _deltaZ = std::numeric_limits<Distance<Key>>::max();
+  int _shift = 0; // integer keys: _deltaZ == 1 << _shift
+  int _nThreads = std::max<int>(std::thread::hardware_concurrency(), 1); // used by set()
+  std::vector<Key> _values;
+  std::vector<uint32_t> _runs;
+  std::vector<uint32_t> _offsets;
+  std::vector<Id> _indices;
+
+  int getKey(Key z) const;
+  // first distinct value >= z (lower) or > z (upper)
+  int lowerBound(Key z) const;
+  int upperBound(Key z) const;
+public:
+  CompactFastContainer() = default;
+  CompactFastContainer(Key lowerBound, Key upperBound);
+  ~CompactFastContainer() = default;
+
+  void set(const std::vector<std::pair<Id, Key>>& input);
+  const Range getClosestId(Key z) const;
+  const Range getIdsInRange(Key lowerZ, Key upperZ) const;
+  inline bool isEmpty() const {return _values.empty();};
+  inline size_t getNCells() const {return _offsets.empty() ? 0 : _offsets.size() - 1;};
+  size_t getMemoryUsage() const;
+  inline int getNThreads() const {return _nThreads;};
+  inline void setNThreads(int nThreads) {_nThreads = std::max(nThreads, 1);};
+};
+
+template <typename Key, typename Id, int BatchSize>
+CompactFastContainer<Key, Id, BatchSize>::CompactFastContainer(Key lowerBound, Key upperBound):
+    _lowerBound(lowerBound),
+    _upperBound(upperBound)
+{
+    // check bounds
+    if (upperBound <= lowerBound)
+        throw std::invalid_argument("Incorrect upper and lower bounds");
+}
+
+template <typename Key, typename Id, int BatchSize>
+void CompactFastContainer<Key, Id, BatchSize>::set(const std::vector<std::pair<Id, Key>>& input)
+{
+    _values.clear();
+    _runs.clear();
+    _offsets.clear();
+    _indices.clear();
+
+    if (input.empty())
+        return;
+
+    // sort by value, equal values keep the input order. O(N)
+    std::vector<std::pair<Id, Key>> sorted(input);
+    std::vector<std::pair<Id, Key>> buffer;
+    radixSort(sorted, buffer, [](const std::pair<Id, Key>& elem){ return orderedBits(elem.second); }, _nThreads);
+
+    // check bounds against input
+    if (sorted.front().second < _lowerBound || sorted.back().second > _upperBound)
+        throw std::invalid_argument("Input is out of range [lower, upper]");
+
+    // ids in order and the runs of the distinct values. O(N)
+    _indices.resize(sorted.size());
+    for (int idx = 0; idx < sorted.size(); ++idx)
+    {
+        _indices[idx] = sorted[idx].first;
+        if (_values.empty() || _values.back() != sorted[idx].second)
+        {
+            _values.push_back(sorted[idx].second);
+            _runs.push_back(idx);
+        }
+    }
+    _runs.push_back(sorted.size());
+    _values.shrink_to_fit();
+    _runs.shrink_to_fit();
+
+    // the bucket width keeps at most BatchSize distinct values in a bucket, as for FastContainer. O(N)
+    Distance<Key> delta = getDistance(_upperBound, _lowerBound);
+    if (_values.size() > BatchSize)
+    {
+        const Distance<Key> span = getMinSpan(_values, BatchSize, _nThreads);
+        delta = span > 0 ? span : delta;
+    }
+
+    size_t nBuckets = 0;
+    if constexpr (std::is_integral_v<Key>)
+    {
+        _shift = getFloorLog2(delta);
+        _deltaZ = Distance<Key>(1) << _shift;
+        nBuckets = (getDistance(_upperBound, _lowerBound) >> _shift) + 1;
+    }
+    else
+    {
+        _deltaZ = delta;
+        nBuckets = std::ceil((_upperBound - _lowerBound) / _deltaZ);
+    }
+
+    // count the values per bucket, the prefix sums give the offsets. O(number of buckets)
+    _offsets.assign(nBuckets + 1, 0);
+    for (const Key value: _values)
+        ++_offsets[getKey(value) + 1];
+    for (size_t key = 0; key < nBuckets; ++key)
+        _offsets[key + 1] += _offsets[key];
+}
+
+template <typename Key, typename Id, int BatchSize>
+int CompactFastContainer<Key, Id, BatchSize>::getKey(Key z) const
+{
+    // bucket of z, clamped to the existing ones
+    const int last = _offsets.size() - 2;
+    if (z <= _lowerBound)
+        return 0;
+
+    if constexpr (std::is_integral_v<Key>)
+    {
+        const Distance<Key> key = getDistance(z, _lowerBound) >> _shift;
+        return key < Distance<Key>(last) ? int(key) : last;
+    }
+    else
+    {
+        const Key key = (z - _lowerBound) / _deltaZ;
+        return key < last ? int(key) : last;
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+int CompactFastContainer<Key, Id, BatchSize>::lowerBound(Key z) const
+{
+    const int key = getKey(z);
+    return std::lower_bound(_values.begin() + _offsets[key], _values.begin() + _offsets[key + 1], z) - _values.begin();
+}
+
+template <typename Key, typename Id, int BatchSize>
+int CompactFastContainer<Key, Id, BatchSize>::upperBound(Key z) const
+{
+    const int key = getKey(z);
+    return std::upper_bound(_values.begin() + _offsets[key], _values.begin() + _offsets[key + 1], z) - _values.begin();
+}
+
+template <typename Key, typename Id, int BatchSize>
+const typename CompactFastContainer<Key, Id, BatchSize>::Range CompactFastContainer<Key, Id, BatchSize>::getClosestId(Key z) const
+{
+    if (isEmpty())
+        return {_indices.end(), _indices.end()};
+
+    // the nearest value is the first one >= z or the one before it
+    int idx = lowerBound(z);
+    if (idx == _values.size() || (idx > 0 && getDistance(z, _values[idx - 1]) <= getDistance(_values[idx], z)))
+        --idx;
+
+    return {_indices.begin() + _runs[idx], _indices.begin() + _runs[idx + 1]};
+}
+
+template <typename Key, typename Id, int BatchSize>
+const typename CompactFastContainer<Key, Id, BatchSize>::Range CompactFastContainer<Key, Id, BatchSize>::getIdsInRange(Key lowerZ, Key upperZ) const
+{
+    if (isEmpty() || upperZ < lowerZ)
+        return {_indices.end(), _indices.end()};
+
+    return {_indices.begin() + _runs[lowerBound(lowerZ)], _indices.begin() + _runs[upperBound(upperZ)]};
+}
+
+template <typename Key, typename Id, int BatchSize>
+size_t CompactFastContainer<Key, Id, BatchSize>::getMemoryUsage() const
+{
+    return sizeof(*this) + _values.capacity() * sizeof(Key) + (_runs.capacity() + _offsets.capacity()) * sizeof(uint32_t)
+        + _indices.capacity() * sizeof(Id);
+}
+
+// common configurations are compiled once in CompactFastContainer.cxx
+extern template class CompactFastContainer<double>;
+extern template class CompactFastContainer<float, uint32_t>;
+extern template class CompactFastContainer<int64_t, uint32_t>;
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "FastContainer.h"
+
+// FastContainer for readers running next to a writer calling set().
+// Every set() builds a new container off to the side and publishes it with an atomic pointer swap,
+// so a reader sees either the old or the new container as a whole. Readers pin the container
+// they use with a hazard pointer: the writer frees a replaced container only when no reader
+// pins it anymore, otherwise it stays retired until a later set() or reclaim().
+// Readers never block and the number of snapshots is not bounded; writers are serialised among themselves.
+template <typename Key, typename Id = int, int BatchSize = 5>
+class ConcurrentFastContainer
+{
+  struct Slot;
+public:
+  using Container = FastContainer<Key, Id, BatchSize>;
+
+  // Pins one container: queries and the iterators they return stay valid while the snapshot lives
+  class Snapshot
+  {
+  private:
+    Slot* _slot = nullptr;
+    const Container* _container = nullptr;
+  public:
+    Snapshot() = default;
+    Snapshot(Slot* slot, const Container* container): _slot(slot), _container(container) {};
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    Snapshot(Snapshot&& other) noexcept {*this = std::move(other);};
+    Snapshot& operator=(Snapshot&& other) noexcept;
+    ~Snapshot() {release();};
+
+    void release();
+    inline const Container& operator*() const {return *_container;};
+    inline const Container* operator->() const {return _container;};
+  };
+
+private:
+  static const int _blockSize = 64; // reader slots per block
+
+  // one cache line per reader slot, so readers on different slots do not share lines
+  struct alignas(64) Slot
+  {
+    std::atomic<bool> used{false};
+    std::atomic<const Container*> hazard{nullptr};
+  };
+  // A reader finding every slot taken appends a block to the last one with a compare and swap,
+  // so the slots grow without a lock. Blocks are only freed with the container
+  struct SlotBlock
+  {
+    std::array<Slot, _blockSize> slots;
+    std::atomic<SlotBlock*> next{nullptr};
+  };
+
+  Key _lowerBound;
+  Key _upperBound;
+  Bucketing _bucketing = Bucketing::Uniform;
+  int _nThreads = std::max<int>(std::thread::hardware_concurrency(), 1); // used by set()
+  std::atomic<const Container*> _current{nullptr};
+  SlotBlock _slots;
+  std::mutex _writerMutex;
+  std::vector<const Container*> _retired; // replaced containers, guarded by _writerMutex
+
+  void reclaimRetired();
+public:
+  ConcurrentFastContainer(Key lowerBound, Key upperBound, Bucketing bucketing = Bucketing::Uniform);
+  ConcurrentFastContainer(const ConcurrentFastContainer&) = delete;
+  ConcurrentFastContainer& operator=(const ConcurrentFastContainer&) = delete;
+  // no snapshot may outlive the container
+  ~ConcurrentFastContainer();
+
+  // builds a new container and publishes it, then frees the replaced ones no reader pins
+  void set(const std::vector<std::pair<Id, Key>>& input);
+  Snapshot getSnapshot();
+  void reclaim();
+  size_t getNRetired();
+  inline int getNThreads() const {return _nThreads;};
+  inline void setNThreads(int nThreads) {_nThreads = std::max(nThreads, 1);};
+};
+
+template <typename Key, typename Id, int BatchSize>
+ConcurrentFastContainer<Key, Id, BatchSize>::ConcurrentFastContainer(Key lowerBound, Key upperBound, Bucketing bucketing):
+    _lowerBound(lowerBound),
+    _upperBound(upperBound),
+    _bucketing(bucketing)
+{
+    // an empty container, so readers always find one. It also checks the bounds
+    _current.store(new Container(lowerBound, upperBound, bucketing));
+}
+
+template <typename Key, typename Id, int BatchSize>
+ConcurrentFastContainer<Key, Id, BatchSize>::~ConcurrentFastContainer()
+{
+    delete _current.load();
+    for (const auto* container: _retired)
+        delete container;
+    for (SlotBlock* block = _slots.next.load(); block != nullptr;)
+        delete std::exchange(block, block->next.load());
+}
+
+template <typename Key, typename Id, int BatchSize>
+void ConcurrentFastContainer<Key, Id, BatchSize>::set(const std::vector<std::pair<Id, Key>>& input)
+{
+    // the build runs outside of the lock, a failed build leaves the published container as it is
+    auto next = std::make_unique<Container>(_lowerBound, _upperBound, _bucketing);
+    next->setNThreads(_nThreads);
+    next->set(input);
+
+    std::lock_guard<std::mutex> lock(_writerMutex);
+    _retired.push_back(_current.exchange(next.release()));
+    reclaimRetired();
+}
+
+template <typename Key, typename Id, int BatchSize>
+typename ConcurrentFastContainer<Key, Id, BatchSize>::Snapshot ConcurrentFastContainer<Key, Id, BatchSize>::getSnapshot()
+{
+    // claim a free slot, starting at a slot depending on the thread to avoid collisions.
+    // Past the last block a new one is appended with its first slot claimed
+    const int start = std::hash<std::thread::id>()(std::this_thread::get_id()) % _blockSize;
+    Slot* slot = nullptr;
+    for (SlotBlock* block = &_slots; slot == nullptr;)
+    {
+        for (int idx = 0; idx < _blockSize && slot == nullptr; ++idx)
+        {
+            Slot& candidate = block->slots[(start + idx) % _blockSize];
+            if (!candidate.used.load(std::memory_order_relaxed) && !candidate.used.exchange(true))
+                slot = &candidate;
+        }
+        if (slot != nullptr)
+            break;
+
+        SlotBlock* next = block->next.load();
+        if (next == nullptr)
+        {
+            auto appended = std::make_unique<SlotBlock>();
+            appended->slots[start].used.store(true, std::memory_order_relaxed);
+            // another reader may have appended first, then next is its block
+            if (block->next.compare_exchange_strong(next, appended.get()))
+            {
+                slot = &appended->slots[start];
+                appended.release();
+                break;
+            }
+        }
+        block = next;
+    }
+
+    // the hazard is valid once the published pointer is still the same after storing it:
+    // a writer swapping later sees the hazard before it frees the container
+    const Container* container = _current.load();
+    while (true)
+    {
+        slot->hazard.store(container);
+        const Container* current = _current.load();
+        if (current == container)
+            break;
+        container = current;
+    }
+    return Snapshot(slot, container);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void ConcurrentFastContainer<Key, Id, BatchSize>::reclaim()
+{
+    std::lock_guard<std::mutex> lock(_writerMutex);
+    reclaimRetired();
+}
+
+template <typename Key, typename Id, int BatchSize>
+size_t ConcurrentFastContainer<Key, Id, BatchSize>::getNRetired()
+{
+    std::lock_guard<std::mutex> lock(_writerMutex);
+    return _retired.size();
+}
+
+template <typename Key, typename Id, int BatchSize>
+void ConcurrentFastContainer<Key, Id, BatchSize>::reclaimRetired()
+{
+    // free every retired container without a hazard pointing to it. O(retired * slots)
+    std::vector<const Container*> pinned;
+    for (const SlotBlock* block = &_slots; block != nullptr; block = block->next.load())
+    {
+        for (const auto& slot: block->slots)
+        {
+            const Container* hazard = slot.hazard.load();
+            if (hazard != nullptr)
+                pinned.push_back(hazard);
+        }
+    }
+
+    auto last = std::partition(_retired.begin(), _retired.end(), [&pinned](const Container* container){
+        return std::find(pinned.begin(), pinned.end(), container) != pinned.end();
+    });
+    for (auto it = last; it != _retired.end(); ++it)
+        delete *it;
+    _retired.erase(last, _retired.end());
+}
+
+template <typename Key, typename Id, int BatchSize>
+typename ConcurrentFastContainer<Key, Id, BatchSize>::Snapshot& ConcurrentFastContainer<Key, Id, BatchSize>::Snapshot::operator=(Snapshot&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        std::swap(_slot, other._slot);
+        std::swap(_container, other._container);
+    }
+    return *this;
+}
+
+template <typename Key, typename Id, int BatchSize>
+void ConcurrentFastContainer<Key, Id, BatchSize>::Snapshot::release()
+{
+    if (_slot == nullptr)
+        return;
+
+    _slot->hazard.store(nullptr);
+    _slot->used.store(false, std::memory_order_release);
+    _slot = nullptr;
+    _container = nullptr;
+}
+
+// common configurations are compiled once in ConcurrentFastContainer.cxx
+extern template class ConcurrentFastContainer<double>;
@@ -1,27 +1,139 @@
+#pragma once
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <exception>
+#include <fstream>
 #include <iostream>
 #include <limits>
-#include <set>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include "MappedFile.h"
+#include "RadixSort.h"
+#include "SimdSearch.h"
+#include "ThreadPool.h"
+
+// Type of the distance between two keys: integers are compared by unsigned distance,
+// so the difference of any two keys is exact
+template <typename T, bool = std::is_integral_v<T>>
+struct DistanceType { using type = T; };
+
+template <typename T>
+struct DistanceType<T, true> { using type = std::make_unsigned_t<T>; };
+
+template <typename T>
+using Distance = typename DistanceType<T>::type;
+
+template <typename T>
+inline Distance<T> getDistance(T lhs, T rhs)
+{
+  return lhs > rhs ? Distance<T>(Distance<T>(lhs) - Distance<T>(rhs)) : Distance<T>(Distance<T>(rhs) - Distance<T>(lhs));
+}
+
+// getDistance without a branch: the floating point difference is antisymmetric, so its absolute value is exact
+template <typename T>
+inline Distance<T> getUncheckedDistance(T lhs, T rhs)
+{
+  if constexpr (std::is_floating_point_v<T>)
+    return std::abs(lhs - rhs);
+  else
+    return getDistance(lhs, rhs);
+}
+
+// condition ? lhs : rhs through a bit mask, compilers keep a branch for the plain select of floating values
+template <typename T>
+inline T selectKey(bool condition, T lhs, T rhs)
+{
+  if constexpr (sizeof(T) > 8)
+    return condition ? lhs : rhs;
+  else
+  {
+    using Bits = std::conditional_t<sizeof(T) == 8, uint64_t, std::conditional_t<sizeof(T) == 4, uint32_t, std::conditional_t<sizeof(T) == 2, uint16_t, uint8_t>>>;
+    Bits lhsBits, rhsBits;
+    std::memcpy(&lhsBits, &lhs, sizeof(T));
+    std::memcpy(&rhsBits, &rhs, sizeof(T));
+    const Bits mask = Bits(0) - Bits(condition);
+    const Bits bits = (lhsBits & mask) | (rhsBits & ~mask);
+    T result;
+    std::memcpy(&result, &bits, sizeof(T));
+    return result;
+  }
+}
+
+// Smallest span of size consecutive sorted values, values.size() >= size. O(N)
+template <typename Values, typename T = typename Values::value_type>
+Distance<T> getMinSpan(const Values& values, int size, int maxThreads, ThreadPool* pool = nullptr)
+{
+  const int nWindows = values.size() - size + 1;
+  const int nThreads = getNWorkers(maxThreads, nWindows);
+  auto minSpan = [&](size_t begin, size_t end)
+  {
+    Distance<T> delta = std::numeric_limits<Distance<T>>::max();
+    for (size_t idx = begin; idx < end; ++idx)
+      delta = std::min(delta, getDistance(values[idx + size - 1], values[idx]));
+    return delta;
+  };
+  if (nThreads == 1)
+    return minSpan(0, nWindows);
+
+  // the threads merge their minimum under a lock, so the call does not allocate
+  Distance<T> delta = std::numeric_limits<Distance<T>>::max();
+  std::mutex mutex;
+  parallelFor(nThreads, nWindows, [&](size_t begin, size_t end, int)
+  {
+    const Distance<T> local = minSpan(begin, end);
+    std::lock_guard<std::mutex> lock(mutex);
+    delta = std::min(delta, local);
+  }, pool);
+  return delta;
+}
+
+// floor(log2(delta)) of an unsigned delta > 0
 template <typename T>
+inline int getFloorLog2(T delta)
+{
+  int shift = 0;
+  while (shift + 1 < std::numeric_limits<T>::digits && (delta >> (shift + 1)) != 0)
+    ++shift;
+  return shift;
+}
+
+template <typename T, int Size = 5>
 class FastStructure
 {
 private:
-  static const int _maxsize = 5;
+  static const int _maxsize = Size;
   int _size;
   std::array<std::pair<int, int>, _maxsize> _indices_pos; // first and last index
-  std::array<T, _maxsize> _values;
+  std::array<T, _maxsize> _values; // only the first _size values are set
   int _lID = -1;
   int _rID = -1;
+  int _next = -1; // next cell of the same uniform bucket when the bucket overflows, -1 if none
 public:
   FastStructure() {
-    _size = 0; _indices_pos.fill({-1, -1});_values.fill(std::numeric_limits<T>::quiet_NaN());
+    _size = 0; _indices_pos.fill({-1, -1});_values.fill(T());
     };
 
   void push_back(const int index, const T& value);
+  void push_back(const std::pair<int, int>& pos, const T& value);
+  void insert(const int idx, const int index, const T& value);
+  void erase(const int idx);
+  // move positions of _indices: first ones from firstFrom on, last ones from lastFrom on
+  void shift(const int firstFrom, const int lastFrom, const int delta);
 
   inline static const int getBatchSize() {return _maxsize;};
   inline const int getSize() const {return _size;}
@@ -29,30 +141,2187 @@ public:
   inline const int getRNearest() const {return _rID;}
   inline void setLNearest(int id) {_lID = id;}
   inline void setRNearest(int id) {_rID = id;}
+  inline const int getNext() const {return _next;}
+  inline void setNext(int id) {_next = id;}
   inline const std::array<T, _maxsize>& getValues() const {return _values;};
   inline const T getFirst() const {return _values.at(0);};
   inline const T getLast() const {return _values.at(_size-1);};
   inline const std::array<std::pair<int, int>, _maxsize>& getIndices() const {return _indices_pos;};
+  inline void setIndices(int idx, const std::pair<int, int>& pos) {_indices_pos.at(idx) = pos;};
   inline const std::pair<int, int>& getFirstIDpos() const {return _indices_pos.at(0);};
   inline const std::pair<int, int>& getLastIDpos() const {return _indices_pos.at(_size-1);};
 };
 
+enum class Bucketing
+{
+  Uniform,  // cells of fixed width _deltaZ
+  Quantile, // cells of getMaxSize() distinct values, found through a uniform directory
+  Learned   // cells of getMaxSize() distinct values, found through a two-level linear model
+};
+
+// Shape of a built container, to see why queries are slow and when to rebuild
+struct ContainerStats
+{
+  size_t nCells = 0;
+  size_t nValues = 0;                // distinct values
+  size_t nIds = 0;
+  size_t memoryUsage = 0;            // bytes, as getMemoryUsage()
+  std::vector<size_t> occupancy;     // occupancy[s]: cells holding s distinct values
+  size_t longestEmptyGap = 0;        // longest run of empty cells, crossed by the neighbour links
+  std::vector<size_t> duplicateRuns; // duplicateRuns[b]: distinct values with [2^b, 2^(b+1)) ids
+  size_t longestDuplicateRun = 0;
+};
+
+// Branches taken by getClosestId. Counted only when compiled with FASTCONTAINER_COUNTERS,
+// otherwise the counting compiles to nothing and the counters stay zero
+struct QueryCounters
+{
+  uint64_t emptyCell = 0;   // the cell of z is empty, the answer is in a neighbour cell
+  uint64_t leftOfCell = 0;  // z is before the first value of its cell
+  uint64_t rightOfCell = 0; // z is after the last value of its cell
+  uint64_t inCell = 0;      // z is among the values of its cell
+};
+
+// One configuration tried by tune(): its predicted cost from the cell layout and its latency measured on the sample
+struct TuningCandidate
+{
+  Bucketing bucketing = Bucketing::Uniform;
+  int maxSize = 0;          // distinct values per cell
+  size_t nCells = 0;
+  size_t memoryUsage = 0;   // bytes
+  double predictedNs = 0;   // per query
+  double measuredNs = 0;    // per query, sample queried twice and the second pass timed
+};
+
+// Cost model of tune(), per query. The defaults were fitted on a desktop x86: every query costs baseNs and the
+// search in the index of its bucketing. Every line read costs hitNs, plus l3Ns or memoryNs for the share of the
+// lines touched by the sample beyond l2Bytes or l3Bytes, and every compare compareNs, one vector of the SIMD
+// kernels counts once. Other machines may fit theirs on the measuredNs of the candidates of a TuningReport
+struct CostModel
+{
+  double baseNs = 10;
+  std::array<double, 3> indexNs = {0, 10, 45}; // uniform, quantile, learned
+  double hitNs = 3;
+  double l3Ns = 20;
+  double memoryNs = 80;
+  double compareNs = 0.5;
+  double l2Bytes = 1 << 20;
+  double l3Bytes = 1 << 25;
+};
+
+struct TuningReport
+{
+  std::vector<TuningCandidate> candidates; // configurations that could be built
+  int chosen = -1;                         // the one the container is rebuilt with
+  double checkedNs = 0;                    // per query, the chosen one measured again with the checked search
+  double kernelNs = 0;                     // and with the kernel of getClosestId
+  bool kernel = false;                     // the kernel runs and kernelNs is below 95% of checkedNs, it is left on
+};
+
+// Key: arithmetic type of the values, integers are bucketed exactly by a shift.
+// Id: type of the stored ids. BatchSize: distinct values per cell
+template <typename Key, typename Id = int, int BatchSize = 5>
 class FastContainer
 {
+  static_assert(std::is_arithmetic_v<Key> && !std::is_same_v<Key, bool>, "Key must be an arithmetic type");
+public:
+  using Bucketing = ::Bucketing;
+  using Cell = FastStructure<Key, BatchSize>;
+  using const_iterator = const Id*;
+  using Range = std::pair<const_iterator, const_iterator>;
+  using Interval = std::pair<Key, Key>; // [lower, upper]
+
 private:
-  int _maxSize = FastStructure<double>::getBatchSize();
-  double _lowerBound;
-  double _upperBound;
-  double _deltaZ = std::numeric_limits<double>::infinity();
-  std::vector<FastStructure<double>> _vec;
-  std::vector<int> _indices;
+  static const int _groupSize = 16; // queries resolved per pipeline stage in getClosestIds
+  static const size_t _pipelineMinBytes = 1 << 18; // smaller cell arrays are queried without the pipeline
+  static const size_t _bulkChunk = 1 << 12; // queries per chunk of the bulk queries on a ThreadPool
+  int _maxSize = Cell::getBatchSize();
+  Key _lowerBound;
+  Key _upperBound;
+  Distance<Key> _deltaZ = std::numeric_limits<Distance<Key>>::max();
+  int _shift = 0; // integer keys: _deltaZ == 1 << _shift
+  Bucketing _bucketing = Bucketing::Uniform;
+  int _nThreads = std::max<int>(std::thread::hardware_concurrency(), 1); // used by set()
+  std::vector<Cell> _vec;
+  std::vector<Id> _indices;
+  // Cells addressed by a key. A full uniform cell is split into an overflow cell appended after them and chained
+  // by getNext(), so an insert never changes the cell width. The links of the cells follow the value order
+  int _nKeys = 0;
+  // value of every id for erase(), built by the first erase and kept by the later updates
+  std::unordered_multimap<Id, Key> _idValues;
+
+  // Buffers of set(), kept with their capacity between calls, so rebuilds of a similar size do not allocate.
+  // The threads of the radix sort and the fill are started once by the first parallel build.
+  // As for std::pmr containers, a copy starts empty on the default resource and an assignment keeps its own
+  struct Scratch
+  {
+    std::pmr::vector<std::pair<Id, Key>> sorted;
+    std::pmr::vector<std::pair<Id, Key>> buffer;
+    std::pmr::vector<std::array<size_t, 256>> histograms;
+    std::pmr::vector<Key> values;
+    std::pmr::vector<int> chunks;
+    std::unique_ptr<ThreadPool> pool;
+    explicit Scratch(std::pmr::memory_resource* resource = std::pmr::get_default_resource()):
+      sorted(resource), buffer(resource), histograms(resource), values(resource), chunks(resource) {};
+    Scratch(const Scratch&): Scratch() {};
+    Scratch& operator=(const Scratch&) {return *this;};
+  };
+  Scratch _scratch;
+  // pool of _nThreads threads for a parallel build of n elements, nullptr for a serial one
+  ThreadPool* getBuildPool(size_t n);
+  static inline uint64_t getSortKey(const std::pair<Id, Key>& elem) {return orderedBits(elem.second);};
+  static bool isSortedByValue(const std::vector<std::pair<Id, Key>>& input);
+  // builds from the input sorted by value
+  void setSorted(ArrayView<std::pair<Id, Key>> sorted);
+
+  // quantile and learned bucketing: first value of every cell and a uniform directory over
+  // the first values of the cells (quantile) or of the model segments (learned). For every
+  // directory slot it stores how many of them map to an earlier slot
+  double _slotWidth = std::numeric_limits<double>::infinity();
+  std::vector<Key> _cellFirst;
+  std::vector<int> _directory;
+
+  // learned bucketing: piecewise linear model of the cell number against the value.
+  // Every segment predicts its cells within _maxError cells
+  struct LinearModel
+  {
+    double slope = 0;
+    double intercept = 0;
+    double errLo = 0; // bounds of (answer - prediction) for any z routed to this model
+    double errHi = 0;
+    int first = 0;    // range of possible answers
+    int last = 0;
+    inline double predict(double z) const {return slope * z + intercept;};
+    int search(ArrayView<Key> keys, Key z) const;
+  };
+  static constexpr double _maxError = 4;
+  std::vector<LinearModel> _leaves;
+  std::vector<Key> _leafFirst;
+
+  // range aggregates over per id weights in the order of _indices: prefix sums and sparse tables,
+  // level l holds the minimum or maximum of the 2^l weights starting at every position
+  std::vector<double> _prefixSums;
+  std::vector<std::vector<double>> _minTable;
+  std::vector<std::vector<double>> _maxTable;
+  void clearWeights();
+
+  // Nearest filled neighbours of every cell for the unchecked getClosestId: the last value of the left one
+  // and the first value of the right one with their cell and slot. They do not hold positions of ids, so an
+  // update only changes the candidates next to the changed cell. A missing neighbour is replaced
+  // by a value of the cell itself, so it never wins. Empty if the kernel is off, there are no filled cells,
+  // the container is mapped or the cells are larger than _kernelMaxBytes: getClosestId searches as the checked path then.
+  // Larger cell arrays are bound by cache misses, and the candidates cost one more miss than the
+  // mispredicted branches they save
+  static const size_t _kernelMaxBytes = 1 << 20;
+  struct Candidates
+  {
+    Key left;
+    Key right;
+    int leftCell;
+    int leftSlot;
+    int rightCell;
+    int rightSlot;
+  };
+  std::vector<Candidates> _candidates;
+  bool _kernel = false; // see setKernel()
+  void setCandidates();
+  // candidates of the cells of the buckets [first, last] after an update
+  void setCandidates(int first, int last);
+  void setCandidate(int key);
+  template <bool Count = true>
+  const Range getClosestIdInCell(int key, Key z) const;
+  // getClosestId without sampling the query, Count = false leaves the branch counters too, for the queries of tune()
+  template <bool Count>
+  const Range findClosestId(Key z) const;
+  // rank of z in the cell: the number of its values below z, or not above z for OrEqual
+  template <bool OrEqual>
+  static inline int getRank(const Cell& p, Key z) {return countBelow<OrEqual>(p.getValues().data(), BatchSize, p.getSize(), z);};
+  // the pipeline of getClosestIds over nQueries queries
+  void getClosestIds(const Key* queries, int nQueries, Id* out) const;
+
+  enum Branch {EmptyCell, LeftOfCell, RightOfCell, InCell};
+  static constexpr uint64_t _sampleStride = 64; // every 64th query is kept for getQuerySample
+  static constexpr size_t _sampleSize = 1 << 12; // the last kept queries
+#ifdef FASTCONTAINER_COUNTERS
+  // relaxed atomics, so concurrent readers can count; a copy starts from the counts of its source
+  template <typename T>
+  struct Counter
+  {
+    std::atomic<T> value{T()};
+    Counter() = default;
+    Counter(const Counter& other): value(other.value.load(std::memory_order_relaxed)) {};
+    Counter& operator=(const Counter& other) {value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed); return *this;};
+  };
+  mutable std::array<Counter<uint64_t>, 4> _counters;
+  mutable Counter<uint64_t> _nQueries;
+  mutable std::vector<Counter<Key>> _sampledQueries = std::vector<Counter<Key>>(_sampleSize);
+#endif
+  template <bool Count = true>
+  inline void countBranch([[maybe_unused]] Branch branch) const
+  {
+#ifdef FASTCONTAINER_COUNTERS
+    if constexpr (Count)
+        _counters[branch].value.fetch_add(1, std::memory_order_relaxed);
+#endif
+  };
+  inline void sampleQuery([[maybe_unused]] Key z) const
+  {
+#ifdef FASTCONTAINER_COUNTERS
+    const uint64_t query = _nQueries.value.fetch_add(1, std::memory_order_relaxed);
+    if (query % _sampleStride == 0)
+        _sampledQueries[query / _sampleStride % _sampleSize].value.store(z, std::memory_order_relaxed);
+#endif
+  };
+
+  CostModel _costModel; // see tune()
+  static constexpr double _maxCellsPerValue = 16; // uniform candidates with more cells are not built
+  double predictProbeNs(const std::vector<Key>& queries) const;
+  double measureProbeNs(const std::vector<Key>& queries) const;
+
+  void setQuantileCells(ArrayView<Key> values);
+  void setNeighbours();
+  // links of the cells of the buckets [first, last] after an update, the cells around them keep theirs
+  void setNeighbours(int first, int last);
+  void split(int key);
+  // bucket of a filled cell: the cell itself, or the uniform cell of its values for an overflow cell
+  int getBucket(int cell) const;
+  // buckets of the filled cells before and after the bucket of cell, the range changed by an update of it
+  std::pair<int, int> getUpdateRange(int cell) const;
+  // overflow cell that is empty after an erase leaves its chain and the last cell takes its place
+  void removeOverflow(int cell);
+  // first cell of the chain of bucket key whose last value is not below z, key itself without overflow
+  int followOverflow(int key, Key z) const;
+  // last filled cell in value order
+  int getLastCell() const;
+  void setDirectory(const std::vector<Key>& keys);
+  void setModel();
+  int searchDirectory(ArrayView<Key> keys, Key z) const;
+  int getKey(Key z) const;
+  void setWidth(Distance<Key> delta);
+  // cell of z clamped to the existing cells, -1 if there are none
+  int getClampedKey(Key z) const;
+  // cell to search for z, moving forward from the cell key of a smaller value. -1 if z is after all values
+  int stepForward(int key, Key z) const;
+  // position in the ids of the first value >= z (lower) or > z (upper), found in the cell key of z.
+  // The end of the ids for key -1
+  int getLowerPos(int key, Key z) const;
+  int getUpperPos(int key, Key z) const;
+  // visitor(index of the query, cell, slot) of the value nearest to every query, in the order of the query values.
+  // Unsorted queries are sorted on pool, or on the calling thread without one
+  template <typename Visitor>
+  void walkNearest(const std::vector<Key>& queries, Visitor visitor, ThreadPool* pool) const;
+  void nearestJoin(const std::vector<Key>& queries, std::vector<Id>& out, ThreadPool* pool) const;
+  void nearestJoin(const std::vector<Key>& queries, Distance<Key> eps, std::vector<std::pair<size_t, Id>>& out, ThreadPool* pool) const;
+  size_t getNUniformCells() const;
+
+  // Containers read by mapFrom() query the file mapping through these views, built ones their vectors.
+  // Updates copy a mapped container into vectors first
+  struct MappedArrays
+  {
+    ArrayView<Cell> cells;
+    ArrayView<Id> indices;
+    ArrayView<Key> cellFirst;
+    ArrayView<int> directory;
+    ArrayView<LinearModel> leaves;
+    ArrayView<Key> leafFirst;
+  };
+  std::shared_ptr<const void> _mapping;
+  MappedArrays _mapped;
+
+  inline ArrayView<Cell> getCellView() const {return _mapping ? _mapped.cells : ArrayView<Cell>(_vec);};
+  inline ArrayView<Id> getIdView() const {return _mapping ? _mapped.indices : ArrayView<Id>(_indices);};
+  inline ArrayView<Key> getCellFirstView() const {return _mapping ? _mapped.cellFirst : ArrayView<Key>(_cellFirst);};
+  inline ArrayView<int> getDirectoryView() const {return _mapping ? _mapped.directory : ArrayView<int>(_directory);};
+  inline ArrayView<LinearModel> getLeafView() const {return _mapping ? _mapped.leaves : ArrayView<LinearModel>(_leaves);};
+  inline ArrayView<Key> getLeafFirstView() const {return _mapping ? _mapped.leafFirst : ArrayView<Key>(_leafFirst);};
+  void unmap();
+
+  // File layout of save() and mapFrom(): the header, then the arrays in the order of MappedArrays,
+  // each one starting at a multiple of _fileAlignment. All positions are offsets from the file start
+  static const uint32_t _fileVersion = 3;
+  static const size_t _fileAlignment = 64;
+  struct FileSection
+  {
+    uint64_t offset;
+    uint64_t count;
+  };
+  struct FileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t keyType;   // sizeof(Key), integral and signed flags
+    uint32_t idSize;
+    uint32_t batchSize;
+    uint32_t cellSize;
+    uint32_t modelSize;
+    int32_t bucketing;
+    int32_t shift;
+    int32_t maxSize;
+    int32_t nKeys;
+    Key lowerBound;
+    Key upperBound;
+    Distance<Key> deltaZ;
+    double slotWidth;
+    FileSection sections[6];
+  };
+  static uint32_t getKeyType() {return sizeof(Key) | std::is_integral_v<Key> << 8 | std::is_signed_v<Key> << 9;};
 public:
   FastContainer() = default;
-  FastContainer(double lowerBound, double upperBound);
+  // The buffers of set() are allocated from resource, e.g. an arena of the event loop. It must outlive the container
+  FastContainer(Key lowerBound, Key upperBound, Bucketing bucketing = Bucketing::Uniform,
+                std::pmr::memory_resource* resource = std::pmr::get_default_resource());
   ~FastContainer() = default;
 
-  void set(const std::vector<std::pair<int, double>>& input);
-  const std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator> getClosestId(double z) const;
-  const std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator> getIdsInRange(double lowerZ, double upperZ) const;
-  inline bool isEmpty() const{return !_vec.size();};
+  // Rebuilds reuse the cells, the ids, the sort buffers and the build threads of the previous set(): once
+  // they have grown to the input size, a rebuild does not allocate. A learned index still grows when the data
+  // needs more segments than before. Input sorted by value is read in place
+  void set(const std::vector<std::pair<Id, Key>>& input);
+  // As above, an unsorted input is sorted in place instead of a copy. input is left sorted by value,
+  // equal values in the input order, so its capacity can be reused for the next call
+  void set(std::vector<std::pair<Id, Key>>&& input);
+  // Local updates: no sorting and no rebuild, the cost is a shift of the positions behind the changed one.
+  // A full cell is split in place: a uniform one into an overflow cell of its bucket, a quantile or learned one
+  // into a new cell after it, which also rebuilds their index. The first erase builds an index of the ids
+  void insert(Id id, Key value);
+  bool erase(Id id);
+  // z outside of the bounds takes the first or the last cell, which is searched as by getClosestIdChecked.
+  // With setKernel() cells resident in cache are searched unchecked and without data dependent branches:
+  // all slots of the cell and its two candidates are compared with conditional moves
+  const Range getClosestId(Key z) const;
+  // The original bounds checked search, the reference for getClosestId. It throws for z outside of the cells
+  const Range getClosestIdChecked(Key z) const;
+  void getClosestIds(const std::vector<Key>& queries, std::vector<Id>& out) const;
+  // Bulk queries shared by the threads of pool, every thread writes the results of its chunks in place.
+  // The container must not change during the call
+  void getClosestIds(const std::vector<Key>& queries, std::vector<Id>& out, ThreadPool& pool) const;
+  // out[idx] is the range of getIdsInRange for intervals[idx]
+  void getIdsInRanges(ArrayView<Interval> intervals, std::vector<Range>& out, ThreadPool& pool) const;
+  // Nearest neighbour join: out[idx] is the id of the value nearest to queries[idx], like getClosestIds.
+  // The queries are radix sorted and matched in one forward walk over the cells, so the cells and the ids
+  // are read in order and every query reuses the cell of the previous one. Either value of a tie is returned.
+  // The sort runs on the calling thread, its buffers are kept per thread so repeated joins do not allocate
+  inline void nearestJoin(const std::vector<Key>& queries, std::vector<Id>& out) const {nearestJoin(queries, out, nullptr);};
+  // The queries sorted by the threads of pool
+  inline void nearestJoin(const std::vector<Key>& queries, std::vector<Id>& out, ThreadPool& pool) const {nearestJoin(queries, out, &pool);};
+  // Only the pairs (index of the query, id) of the queries with a value within eps, in the order of the query values
+  inline void nearestJoin(const std::vector<Key>& queries, Distance<Key> eps, std::vector<std::pair<size_t, Id>>& out) const
+  {
+    nearestJoin(queries, eps, out, nullptr);
+  };
+  inline void nearestJoin(const std::vector<Key>& queries, Distance<Key> eps, std::vector<std::pair<size_t, Id>>& out, ThreadPool& pool) const
+  {
+    nearestJoin(queries, eps, out, &pool);
+  };
+  // ids of the k nearest points, nearest first; ties of a value keep their order. out is reused
+  void getKClosest(Key z, int k, std::vector<Id>& out) const;
+  const Range getIdsInRange(Key lowerZ, Key upperZ) const;
+  // visitor(index of the interval, first, last) for the ids of every interval, in the order of the lower ends.
+  // One forward walk over the cells: sorted and overlapping intervals reuse the cells found before
+  template <typename Visitor>
+  void forEachInRanges(ArrayView<Interval> intervals, Visitor visitor) const;
+  // Aggregates of the ids in [lowerZ, upperZ], each one costs the two cell lookups of getIdsInRange.
+  // sumInRange and minMaxInRange need setWeights(), any update drops the weights
+  size_t countInRange(Key lowerZ, Key upperZ) const;
+  double sumInRange(Key lowerZ, Key upperZ) const;
+  // {+inf, -inf} for an empty range
+  std::pair<double, double> minMaxInRange(Key lowerZ, Key upperZ) const;
+  // weight(id) of every stored id. O(N log N) time and memory for the sparse tables
+  template <typename WeightFn>
+  void setWeights(WeightFn weight);
+  inline bool hasWeights() const {return !_prefixSums.empty();};
+  // Writes the built container in a versioned, position independent binary format
+  void save(const std::string& path) const;
+  // Container querying the mapped file in place: no copy and no parsing, the pages are shared
+  // between processes mapping the same file. The file is only checked against its layout: the type, the parameters
+  // and the section sizes, the cells themselves are not read
+  static FastContainer mapFrom(const std::string& path);
+  inline bool isMapped() const {return bool(_mapping);};
+  inline bool isEmpty() const{return !getCellView().size();};
+  // ids in the order of their values, the ranges of the queries point into them
+  inline const_iterator begin() const {return getIdView().begin();};
+  inline const_iterator end() const {return getIdView().end();};
+  inline Bucketing getBucketing() const {return _bucketing;};
+  inline size_t getNCells() const {return getCellView().size();};
+  size_t getMemoryUsage() const;
+  // O(number of cells)
+  ContainerStats getStats() const;
+  QueryCounters getQueryCounters() const;
+  // every 64th query of getClosestId, the last 4096 of them. Empty without FASTCONTAINER_COUNTERS
+  std::vector<Key> getQuerySample() const;
+  void resetQueryCounters();
+  // Rebuilds from input with every bucketing and every cell size from 2 to BatchSize distinct values, and keeps
+  // the one with the lowest predicted cost for the queries within memoryBudget bytes. Of candidates within 5%
+  // of the lowest cost the smallest one is taken, and the kernel is turned on if it measures faster on it.
+  // The queries may come from getQuerySample(), they are not sampled nor counted again. A candidate that cannot be
+  // built is skipped. If none fits, the container is built from input with its own bucketing, cell size and kernel
+  // before the error is thrown
+  TuningReport tune(const std::vector<std::pair<Id, Key>>& input, const std::vector<Key>& queries, size_t memoryBudget = std::numeric_limits<size_t>::max());
+  inline const CostModel& getCostModel() const {return _costModel;};
+  inline void setCostModel(const CostModel& costModel) {_costModel = costModel;};
+  inline int getMaxSize() const {return _maxSize;};
+  // Distinct values per cell from the next set() on, 2 to BatchSize. Cells as wide as a vector, e.g. BatchSize 8
+  // for double or 16 for float with AVX-512, are searched by one compare: fewer and fuller cells cost no more per query
+  void setMaxSize(int maxSize);
+  // The branch-free kernel of getClosestId. It costs the candidates of every cell and measured slower than the
+  // checked search on uniform cells, so it is off by default. tune() turns it on where it measures faster.
+  // It only runs while the cells and their candidates take at most _kernelMaxBytes (1 MB) and the container
+  // is not mapped; the setting is kept, and a later set() with fewer cells turns the kernel on
+  void setKernel(bool kernel);
+  // getClosestId runs the kernel: it is set and the container is within its limits
+  inline bool hasKernel() const {return !_candidates.empty() && _candidates.size() == getCellView().size();};
+  inline int getNThreads() const {return _nThreads;};
+  inline void setNThreads(int nThreads) {_nThreads = std::max(nThreads, 1);};
 };
+
+template <typename Key, typename Id, int BatchSize>
+FastContainer<Key, Id, BatchSize>::FastContainer(Key lowerBound, Key upperBound, Bucketing bucketing, std::pmr::memory_resource* resource):
+    _lowerBound(lowerBound),
+    _upperBound(upperBound),
+    _bucketing(bucketing),
+    _scratch(resource)
+{
+    // check bounds
+    if (upperBound <= lowerBound)
+        throw std::invalid_argument("Incorrect upper and lower bounds");
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setMaxSize(int maxSize)
+{
+    if (maxSize < 2 || maxSize > BatchSize)
+        throw std::invalid_argument("Cell size is out of range [2, BatchSize]");
+    _maxSize = maxSize;
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setKernel(bool kernel)
+{
+    // a mapped container has no cells in memory to store the candidates with, it keeps the checked search
+    _kernel = kernel;
+    setCandidates();
+}
+
+template <typename Key, typename Id, int BatchSize>
+ThreadPool* FastContainer<Key, Id, BatchSize>::getBuildPool(size_t n)
+{
+    if (getNWorkers(_nThreads, n) == 1)
+        return nullptr;
+    if (!_scratch.pool || _scratch.pool->getNThreads() != _nThreads)
+        _scratch.pool = std::make_unique<ThreadPool>(_nThreads);
+    return _scratch.pool.get();
+}
+
+template <typename Key, typename Id, int BatchSize>
+bool FastContainer<Key, Id, BatchSize>::isSortedByValue(const std::vector<std::pair<Id, Key>>& input)
+{
+    return std::is_sorted(input.begin(), input.end(), [](const std::pair<Id, Key>& lhs, const std::pair<Id, Key>& rhs){
+        return getSortKey(lhs) < getSortKey(rhs);
+    });
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::set(const std::vector<std::pair<Id, Key>>& input)
+{
+    if (isSortedByValue(input))
+    {
+        setSorted(input);
+        return;
+    }
+
+    // sort by value, equal values keep the input order. O(N)
+    _scratch.sorted.assign(input.begin(), input.end());
+    radixSort(_scratch.sorted, _scratch.buffer, _scratch.histograms, getSortKey, _nThreads, getBuildPool(input.size()));
+    setSorted(_scratch.sorted);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::set(std::vector<std::pair<Id, Key>>&& input)
+{
+    if (!isSortedByValue(input))
+        radixSort(input, _scratch.buffer, _scratch.histograms, getSortKey, _nThreads, getBuildPool(input.size()));
+    setSorted(input);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setSorted(ArrayView<std::pair<Id, Key>> sorted)
+{
+    _mapping.reset();
+    _mapped = MappedArrays();
+    clearWeights();
+    _vec.clear();
+    _indices.clear();
+    _candidates.clear();
+    _idValues.clear();
+    _nKeys = 0;
+    _deltaZ = std::numeric_limits<Distance<Key>>::max();
+    _shift = 0;
+
+    if (sorted.size() < _maxSize)
+        setWidth(getDistance(_upperBound, _lowerBound));
+
+    if (sorted.empty())
+        return;
+
+    // create distinct values. O(N)
+    auto& values = _scratch.values;
+    values.clear();
+    for (const auto& elem: sorted)
+    {
+        if (values.empty() || values.back() != elem.second)
+            values.push_back(elem.second);
+    }
+
+    // check bounds against input
+    if (values.front() < _lowerBound || values.back() > _upperBound)
+        throw std::invalid_argument("Input is out of range [lower, upper]"); 
+
+    if (_bucketing != Bucketing::Uniform)
+    {
+        // cells follow the data, so their number is bound by the input size. O(N)
+        setQuantileCells(values);
+
+        if (_bucketing == Bucketing::Quantile)
+            setDirectory(_cellFirst);
+        else
+            setModel();
+    }
+    // find the batch step. O(N)
+    else if (values.size() <= _maxSize)
+        setWidth(getDistance(_upperBound, _lowerBound));
+    else{
+        const Distance<Key> delta = getMinSpan(values, _maxSize, _nThreads, getBuildPool(values.size()));
+        setWidth(delta > 0 ? delta : getDistance(_upperBound, _lowerBound));
+    }
+
+    // fill every cell
+    if (_bucketing == Bucketing::Uniform)
+        _vec.assign(getNUniformCells(), Cell());
+    _indices.resize(sorted.size());
+
+    // fill new map by input values. O(N)
+    // The sorted input is cut into chunks starting at a new cell, so every thread fills its own cells
+    // at the positions given by the order
+    const int nThreads = getNWorkers(_nThreads, sorted.size());
+    auto& chunks = _scratch.chunks;
+    chunks.assign(nThreads + 1, sorted.size());
+    chunks.front() = 0;
+    for (int thread = 1; thread < nThreads; ++thread)
+    {
+        int idx = std::max<int>(chunks[thread - 1], thread * (sorted.size() / nThreads));
+        while (idx < sorted.size() && getKey(sorted[idx].second) == getKey(sorted[idx - 1].second))
+            ++idx;
+        chunks[thread] = idx;
+    }
+    parallelFor(nThreads, nThreads, [&](size_t, size_t, int thread)
+    {
+        for (int idx = chunks[thread]; idx < chunks[thread + 1]; ++idx)
+        {
+            const auto& elem = sorted[idx];
+            _vec.at(getKey(elem.second)).push_back(idx, elem.second);
+            _indices[idx] = elem.first;
+        }
+    }, getBuildPool(sorted.size()));
+
+    _nKeys = _vec.size();
+    setNeighbours();
+    setCandidates();
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setCandidates()
+{
+    _candidates.clear();
+    if (!_kernel || _vec.size() * (sizeof(Cell) + sizeof(Candidates)) > _kernelMaxBytes)
+        return;
+    if (std::all_of(_vec.begin(), _vec.end(), [](const Cell& p){ return p.getSize() == 0; }))
+        return;
+
+    _candidates.resize(_vec.size());
+    for (int key = 0; key < _vec.size(); ++key)
+        setCandidate(key);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setCandidates(int first, int last)
+{
+    // a container without candidates stays without, the cells added by splits may cross _kernelMaxBytes
+    if (_candidates.empty())
+        return;
+    if (_vec.size() * (sizeof(Cell) + sizeof(Candidates)) > _kernelMaxBytes)
+    {
+        _candidates.clear();
+        return;
+    }
+    _candidates.resize(_vec.size());
+
+    for (int bucket = first; bucket <= last; ++bucket)
+    {
+        for (int key = bucket; key > -1; key = _vec[key].getNext())
+            setCandidate(key);
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setCandidate(int key)
+{
+    const auto& p = _vec[key];
+    auto& c = _candidates[key];
+    const int lID = p.getLNearest();
+    const int rID = p.getRNearest();
+    if (lID > -1)
+        c = {_vec[lID].getLast(), _vec[lID].getLast(), lID, _vec[lID].getSize() - 1, lID, _vec[lID].getSize() - 1};
+    if (rID > -1)
+    {
+        c.right = _vec[rID].getFirst();
+        c.rightCell = rID;
+        c.rightSlot = 0;
+    }
+
+    // stand-ins for a missing neighbour: the nearest value of the cell or the other neighbour
+    if (lID == -1)
+    {
+        c.left = p.getSize() > 0 ? p.getFirst() : c.right;
+        c.leftCell = p.getSize() > 0 ? key : c.rightCell;
+        c.leftSlot = p.getSize() > 0 ? 0 : c.rightSlot;
+    }
+    if (rID == -1)
+    {
+        c.right = p.getSize() > 0 ? p.getLast() : c.left;
+        c.rightCell = p.getSize() > 0 ? key : c.leftCell;
+        c.rightSlot = p.getSize() > 0 ? p.getSize() - 1 : c.leftSlot;
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setNeighbours()
+{
+    // fill empty cells by indices to the nearest, the cells are in value order: no overflow cells yet
+    int tmpL = -1;
+    for (int idx = 0; idx < _vec.size(); ++idx)
+    {
+        _vec.at(idx).setLNearest(tmpL);
+        if (_vec.at(idx).getSize() != 0)
+            tmpL = idx;
+    }
+
+    int tmpR = -1;
+    for (int idx = _vec.size() - 1; idx >= 0; --idx)
+    {
+        _vec.at(idx).setRNearest(tmpR);
+        if (_vec.at(idx).getSize() != 0)
+            tmpR = idx;
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setNeighbours(int first, int last)
+{
+    auto getTail = [this](int key)
+    {
+        while (_vec[key].getNext() > -1)
+            key = _vec[key].getNext();
+        return key;
+    };
+
+    // the cells of a bucket are its cell and its chain, which holds filled cells only.
+    // Forward every cell gets the last filled cell before it, backward the last cell of every chain
+    // gets the first filled cell after it
+    int lID = _vec[first].getLNearest();
+    for (int bucket = first; bucket <= last; ++bucket)
+    {
+        for (int key = bucket; key > -1; key = _vec[key].getNext())
+        {
+            auto& p = _vec[key];
+            p.setLNearest(lID);
+            if (p.getNext() > -1)
+                p.setRNearest(p.getNext());
+            if (p.getSize() != 0)
+                lID = key;
+        }
+    }
+
+    int rID = _vec[getTail(last)].getRNearest();
+    for (int bucket = last; bucket >= first; --bucket)
+    {
+        _vec[getTail(bucket)].setRNearest(rID);
+        if (_vec[bucket].getSize() != 0)
+            rID = bucket;
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::getBucket(int cell) const
+{
+    return cell < _nKeys ? cell : std::clamp(getKey(_vec[cell].getFirst()), 0, _nKeys - 1);
+}
+
+template <typename Key, typename Id, int BatchSize>
+std::pair<int, int> FastContainer<Key, Id, BatchSize>::getUpdateRange(int cell) const
+{
+    const int bucket = getBucket(cell);
+    int tail = bucket;
+    while (_vec[tail].getNext() > -1)
+        tail = _vec[tail].getNext();
+
+    const int lID = _vec[bucket].getLNearest();
+    const int rID = _vec[tail].getRNearest();
+    return {lID > -1 ? getBucket(lID) : 0, rID > -1 ? getBucket(rID) : _nKeys - 1};
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::insert(Id id, Key value)
+{
+    if (value < _lowerBound || value > _upperBound)
+        throw std::invalid_argument("Input is out of range [lower, upper]");
+
+    if (isEmpty())
+    {
+        set({{id, value}});
+        return;
+    }
+    unmap();
+    clearWeights();
+
+    // find the place of the value in its cell, split while it is full
+    int key = getClampedKey(value);
+    int idx = 0;
+    bool exists = false;
+    while (true)
+    {
+        const auto& p = _vec.at(key);
+        idx = getRank<false>(p, value);
+        exists = idx < p.getSize() && p.getValues()[idx] == value;
+        if (exists || p.getSize() < _maxSize)
+            break;
+
+        split(key);
+        key = getClampedKey(value);
+    }
+    const auto [first, last] = getUpdateRange(key);
+
+    // new id goes after the run of its value, or in front of the next value
+    auto& p = _vec.at(key);
+    const int size = p.getSize();
+    int pos = -1;
+    if (exists)
+        pos = p.getIndices().at(idx).second + 1;
+    else if (idx < size)
+        pos = p.getIndices().at(idx).first;
+    else if (size > 0)
+        pos = p.getLastIDpos().second + 1;
+    else
+        pos = p.getRNearest() > -1 ? _vec.at(p.getRNearest()).getFirstIDpos().first : _indices.size();
+
+    _indices.insert(_indices.begin() + pos, id);
+    for (int cell = size > 0 ? key : p.getRNearest(); cell > -1; cell = _vec.at(cell).getRNearest())
+        _vec.at(cell).shift(pos, pos, 1);
+
+    if (exists)
+        p.setIndices(idx, {p.getIndices().at(idx).first, pos});
+    else
+        p.insert(idx, pos, value);
+    if (!_idValues.empty())
+        _idValues.emplace(id, value);
+
+    // the links and the candidates change up to the filled cells around the bucket
+    setNeighbours(first, last);
+    setCandidates(first, last);
+}
+
+template <typename Key, typename Id, int BatchSize>
+bool FastContainer<Key, Id, BatchSize>::erase(Id id)
+{
+    unmap();
+    if (_idValues.empty())
+    {
+        // O(N) once, the updates keep the index from then on
+        _idValues.reserve(_indices.size());
+        for (const auto& p: _vec)
+        {
+            for (int idx = 0; idx < p.getSize(); ++idx)
+            {
+                for (int pos = p.getIndices()[idx].first; pos <= p.getIndices()[idx].second; ++pos)
+                    _idValues.emplace(_indices[pos], p.getValues()[idx]);
+            }
+        }
+    }
+
+    // an id stored with several values leaves with its lowest one, the first one in the ids
+    const auto [begin, end] = _idValues.equal_range(id);
+    if (begin == end)
+        return false;
+    const auto it = std::min_element(begin, end, [](const auto& lhs, const auto& rhs){ return lhs.second < rhs.second; });
+    const Key value = it->second;
+    _idValues.erase(it);
+    clearWeights();
+
+    // the id is in the run of its value
+    const int key = getClampedKey(value);
+    const auto [first, last] = getUpdateRange(key);
+    auto& p = _vec.at(key);
+    const int idx = getRank<false>(p, value);
+    const auto run = p.getIndices().at(idx);
+    const int pos = std::find(_indices.begin() + run.first, _indices.begin() + run.second + 1, id) - _indices.begin();
+    if (run.first == run.second)
+        p.erase(idx);
+
+    _indices.erase(_indices.begin() + pos);
+    for (int cell = key; cell > -1; cell = _vec.at(cell).getRNearest())
+        _vec.at(cell).shift(pos + 1, pos, -1);
+
+    if (_indices.empty())
+    {
+        _vec.clear();
+        _candidates.clear();
+        _idValues.clear();
+        _nKeys = 0;
+        return true;
+    }
+
+    // an empty cell leaves the chain of its bucket: the next cell of the chain moves into an empty bucket cell,
+    // an empty overflow cell is unlinked from the one before it
+    int removed = -1;
+    if (p.getSize() == 0 && key < _nKeys && p.getNext() > -1)
+    {
+        removed = p.getNext();
+        const int lID = p.getLNearest();
+        p = _vec[removed];
+        p.setLNearest(lID);
+    }
+    else if (p.getSize() == 0 && key >= _nKeys)
+    {
+        auto& previous = _vec[p.getLNearest()];
+        previous.setNext(p.getNext());
+        if (p.getNext() == -1)
+            previous.setRNearest(p.getRNearest());
+        removed = key;
+    }
+
+    setNeighbours(first, last);
+    setCandidates(first, last);
+    if (removed > -1)
+        removeOverflow(removed);
+    return true;
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::removeOverflow(int cell)
+{
+    // the last cell moves into the place of the removed one. It is an overflow cell as well,
+    // so the one before it is in its chain
+    const int moved = _vec.size() - 1;
+    const bool candidates = _candidates.size() == _vec.size();
+    if (cell != moved)
+    {
+        _vec[cell] = _vec[moved];
+        _vec[_vec[cell].getLNearest()].setNext(cell);
+        if (candidates)
+            _candidates[cell] = _candidates[moved];
+    }
+    _vec.pop_back();
+    if (candidates)
+        _candidates.pop_back();
+
+    // the links to the moved cell reach up to the filled cells around its bucket
+    if (cell != moved)
+    {
+        const auto [first, last] = getUpdateRange(cell);
+        setNeighbours(first, last);
+        setCandidates(first, last);
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::split(int key)
+{
+    if (_bucketing == Bucketing::Uniform)
+    {
+        // the upper half of the cell moves into a new overflow cell after it in the chain of its bucket.
+        // The width and the other cells stay, insert() updates the links around the bucket. O(1)
+        Cell upper;
+        auto& p = _vec.at(key);
+        const int half = p.getSize() / 2;
+        for (int idx = half; idx < p.getSize(); ++idx)
+            upper.push_back(p.getIndices()[idx], p.getValues()[idx]);
+        while (p.getSize() > half)
+            p.erase(p.getSize() - 1);
+
+        upper.setNext(p.getNext());
+        upper.setLNearest(key);
+        upper.setRNearest(p.getRNearest());
+        p.setNext(_vec.size());
+        p.setRNearest(_vec.size());
+        _vec.push_back(upper);
+    }
+    else
+    {
+        // the upper half of the cell moves into a new cell right after it
+        Cell lower;
+        Cell upper;
+        const auto& p = _vec.at(key);
+        for (int idx = 0; idx < p.getSize(); ++idx)
+        {
+            auto& half = idx < p.getSize() / 2 ? lower : upper;
+            half.push_back(p.getIndices()[idx], p.getValues()[idx]);
+        }
+        _vec.at(key) = lower;
+        _vec.insert(_vec.begin() + key + 1, upper);
+        ++_nKeys;
+        // the first cell also keeps values inserted below its first value
+        _cellFirst.at(key) = std::min(_cellFirst.at(key), lower.getFirst());
+        _cellFirst.insert(_cellFirst.begin() + key + 1, upper.getFirst());
+
+        if (_bucketing == Bucketing::Quantile)
+            setDirectory(_cellFirst);
+        else
+            setModel();
+
+        // the cells after it moved, their links and candidates are rebuilt as the index. O(number of cells)
+        setNeighbours();
+        setCandidates();
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setWidth(Distance<Key> delta)
+{
+    // integer cells are a power of two wide, so the key is a shift of the offset
+    if constexpr (std::is_integral_v<Key>)
+    {
+        _shift = getFloorLog2(delta);
+        _deltaZ = Distance<Key>(1) << _shift;
+    }
+    else
+        _deltaZ = delta;
+}
+
+template <typename Key, typename Id, int BatchSize>
+size_t FastContainer<Key, Id, BatchSize>::getNUniformCells() const
+{
+    // the key of the upper bound is the last cell, also when the range is a multiple of the width
+    if constexpr (std::is_integral_v<Key>)
+        return (getDistance(_upperBound, _lowerBound) >> _shift) + 1;
+    else
+        return size_t((_upperBound - _lowerBound) / _deltaZ) + 1;
+}
+
+template <typename Key, typename Id, int BatchSize>
+size_t FastContainer<Key, Id, BatchSize>::getMemoryUsage() const
+{
+    // allocated bytes of the cells, the ids and the quantile or learned index. Mapped arrays are shared pages
+    return sizeof(*this) + _vec.capacity() * sizeof(Cell) + _indices.capacity() * sizeof(Id)
+        + (_cellFirst.capacity() + _leafFirst.capacity()) * sizeof(Key) + _directory.capacity() * sizeof(int)
+        + _leaves.capacity() * sizeof(LinearModel) + _candidates.capacity() * sizeof(Candidates) + _prefixSums.capacity() * sizeof(double)
+        + std::accumulate(_minTable.begin(), _minTable.end(), size_t(0), [](size_t sum, const auto& level){ return sum + level.capacity(); }) * 2 * sizeof(double);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::unmap()
+{
+    if (!_mapping)
+        return;
+
+    _vec.assign(_mapped.cells.begin(), _mapped.cells.end());
+    _indices.assign(_mapped.indices.begin(), _mapped.indices.end());
+    _cellFirst.assign(_mapped.cellFirst.begin(), _mapped.cellFirst.end());
+    _directory.assign(_mapped.directory.begin(), _mapped.directory.end());
+    _leaves.assign(_mapped.leaves.begin(), _mapped.leaves.end());
+    _leafFirst.assign(_mapped.leafFirst.begin(), _mapped.leafFirst.end());
+    _mapping.reset();
+    _mapped = MappedArrays();
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::save(const std::string& path) const
+{
+    // the cells are written as bytes: no pointers and nothing to destroy
+    static_assert(std::is_standard_layout_v<Cell> && std::is_trivially_destructible_v<Cell>, "Cells must be plain data");
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "FASTCONT", sizeof(header.magic));
+    header.version = _fileVersion;
+    header.keyType = getKeyType();
+    header.idSize = sizeof(Id);
+    header.batchSize = BatchSize;
+    header.cellSize = sizeof(Cell);
+    header.modelSize = sizeof(LinearModel);
+    header.bucketing = int32_t(_bucketing);
+    header.shift = _shift;
+    header.maxSize = _maxSize;
+    header.nKeys = _nKeys;
+    header.lowerBound = _lowerBound;
+    header.upperBound = _upperBound;
+    header.deltaZ = _deltaZ;
+    header.slotWidth = _slotWidth;
+
+    const auto cells = getCellView();
+    const auto ids = getIdView();
+    const auto cellFirst = getCellFirstView();
+    const auto directory = getDirectoryView();
+    const auto leaves = getLeafView();
+    const auto leafFirst = getLeafFirstView();
+    const std::array<std::pair<const char*, size_t>, 6> arrays = {{
+        {reinterpret_cast<const char*>(cells.data()), cells.size() * sizeof(Cell)},
+        {reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(Id)},
+        {reinterpret_cast<const char*>(cellFirst.data()), cellFirst.size() * sizeof(Key)},
+        {reinterpret_cast<const char*>(directory.data()), directory.size() * sizeof(int)},
+        {reinterpret_cast<const char*>(leaves.data()), leaves.size() * sizeof(LinearModel)},
+        {reinterpret_cast<const char*>(leafFirst.data()), leafFirst.size() * sizeof(Key)}
+    }};
+    const std::array<size_t, 6> counts = {cells.size(), ids.size(), cellFirst.size(), directory.size(), leaves.size(), leafFirst.size()};
+
+    auto align = [](size_t offset){ return (offset + _fileAlignment - 1) / _fileAlignment * _fileAlignment; };
+    size_t offset = align(sizeof(header));
+    for (int idx = 0; idx < 6; ++idx)
+    {
+        header.sections[idx] = {offset, counts[idx]};
+        offset = align(offset + arrays[idx].second);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        throw std::runtime_error("Cannot open " + path);
+
+    const std::vector<char> padding(_fileAlignment, 0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    size_t written = sizeof(header);
+    for (int idx = 0; idx < 6; ++idx)
+    {
+        file.write(padding.data(), header.sections[idx].offset - written);
+        file.write(arrays[idx].first, arrays[idx].second);
+        written = header.sections[idx].offset + arrays[idx].second;
+    }
+    file.write(padding.data(), offset - written);
+
+    if (!file)
+        throw std::runtime_error("Cannot write " + path);
+}
+
+template <typename Key, typename Id, int BatchSize>
+FastContainer<Key, Id, BatchSize> FastContainer<Key, Id, BatchSize>::mapFrom(const std::string& path)
+{
+    const auto [mapping, size] = mapFile(path);
+    const char* base = static_cast<const char*>(mapping.get());
+
+    // check the layout against this type, the header is read in place as well
+    if (size < sizeof(FileHeader))
+        throw std::runtime_error("File is too short: " + path);
+    const FileHeader& header = *reinterpret_cast<const FileHeader*>(base);
+    if (std::memcmp(header.magic, "FASTCONT", sizeof(header.magic)) != 0)
+        throw std::runtime_error("Not a FastContainer file: " + path);
+    if (header.version != _fileVersion)
+        throw std::runtime_error("Unsupported file version " + std::to_string(header.version) + ": " + path);
+    if (header.keyType != getKeyType() || header.idSize != sizeof(Id) || header.batchSize != BatchSize
+        || header.cellSize != sizeof(Cell) || header.modelSize != sizeof(LinearModel))
+        throw std::runtime_error("File is written for another container type: " + path);
+
+    // every section lies after the header and within the file
+    const auto& sections = header.sections;
+    const std::array<size_t, 6> sizes = {sizeof(Cell), sizeof(Id), sizeof(Key), sizeof(int), sizeof(LinearModel), sizeof(Key)};
+    for (int idx = 0; idx < 6; ++idx)
+    {
+        const auto& section = sections[idx];
+        if (section.offset % _fileAlignment != 0 || section.offset < sizeof(FileHeader) || section.offset > size
+            || section.count > (size - section.offset) / sizes[idx])
+            throw std::runtime_error("Corrupted file: " + path);
+    }
+
+    FastContainer container;
+    container._lowerBound = header.lowerBound;
+    container._upperBound = header.upperBound;
+    container._deltaZ = header.deltaZ;
+    container._shift = header.shift;
+    container._bucketing = Bucketing(header.bucketing);
+    container._maxSize = header.maxSize;
+    container._nKeys = header.nKeys;
+    container._slotWidth = header.slotWidth;
+
+    // the parameters and the section sizes agree with each other: the cells of the keys, the index of the bucketing.
+    // The contents of the sections are not read
+    const uint64_t nCells = sections[0].count;
+    bool valid = header.bucketing >= int32_t(Bucketing::Uniform) && header.bucketing <= int32_t(Bucketing::Learned)
+        && header.maxSize >= std::min(BatchSize, 2) && header.maxSize <= BatchSize && header.upperBound > header.lowerBound
+        && (nCells == 0) == (sections[1].count == 0) && header.nKeys >= 0 && uint64_t(header.nKeys) <= nCells;
+    if constexpr (std::is_integral_v<Key>)
+        valid = valid && header.shift >= 0 && header.shift < std::numeric_limits<Distance<Key>>::digits;
+    else
+        valid = valid && header.deltaZ > 0 && std::isfinite(header.deltaZ);
+    if (valid && container._bucketing == Bucketing::Uniform)
+    {
+        // a width far too small for the cells would overflow their count
+        if constexpr (!std::is_integral_v<Key>)
+            valid = nCells == 0 || (double(header.upperBound) - double(header.lowerBound)) / header.deltaZ < double(nCells);
+        valid = valid && (nCells == 0 || header.nKeys == container.getNUniformCells()) && sections[2].count == 0
+            && sections[3].count == 0 && sections[4].count == 0 && sections[5].count == 0;
+    }
+    else if (valid)
+    {
+        // the directory holds two slots per key and one more, over the cells or over the segments
+        const uint64_t nKeys = container._bucketing == Bucketing::Quantile ? nCells : sections[5].count;
+        valid = uint64_t(header.nKeys) == nCells && sections[2].count == nCells && (nCells == 0 || sections[3].count == 2 * nKeys + 1)
+            && (container._bucketing == Bucketing::Quantile ? sections[4].count == 0 && sections[5].count == 0
+                                                            : sections[4].count == sections[5].count && (nCells == 0 || sections[4].count > 0));
+    }
+    if (!valid)
+        throw std::runtime_error("Corrupted file: " + path);
+
+    container._mapped.cells = ArrayView<Cell>(reinterpret_cast<const Cell*>(base + sections[0].offset), sections[0].count);
+    container._mapped.indices = ArrayView<Id>(reinterpret_cast<const Id*>(base + sections[1].offset), sections[1].count);
+    container._mapped.cellFirst = ArrayView<Key>(reinterpret_cast<const Key*>(base + sections[2].offset), sections[2].count);
+    container._mapped.directory = ArrayView<int>(reinterpret_cast<const int*>(base + sections[3].offset), sections[3].count);
+    container._mapped.leaves = ArrayView<LinearModel>(reinterpret_cast<const LinearModel*>(base + sections[4].offset), sections[4].count);
+    container._mapped.leafFirst = ArrayView<Key>(reinterpret_cast<const Key*>(base + sections[5].offset), sections[5].count);
+    container._mapping = mapping;
+    return container;
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setQuantileCells(ArrayView<Key> values)
+{
+    // every cell takes _maxSize consecutive distinct values
+    const int nCells = (values.size() + _maxSize - 1) / _maxSize;
+    _cellFirst.clear();
+    _cellFirst.reserve(nCells);
+    for (int idx = 0; idx < values.size(); idx += _maxSize)
+        _cellFirst.push_back(values[idx]);
+    _vec.assign(nCells, Cell());
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setDirectory(const std::vector<Key>& keys)
+{
+    // The directory is a uniform grid over [lower, upper] with two slots per key.
+    // A query mapped to slot s lies after one of the keys mapped to slot s,
+    // or after the last key of the previous slots, so the slot pins down a short run of keys.
+    const int nSlots = 2 * keys.size();
+    _slotWidth = (double(_upperBound) - double(_lowerBound)) / nSlots;
+    _directory.assign(nSlots + 1, 0);
+    for (const Key key: keys)
+    {
+        int slot = (double(key) - double(_lowerBound)) / _slotWidth;
+        slot = slot < nSlots ? slot : nSlots - 1;
+        ++_directory.at(slot + 1);
+    }
+    for (int slot = 0; slot < nSlots; ++slot)
+        _directory[slot + 1] += _directory[slot];
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::setModel()
+{
+    const int nCells = _cellFirst.size();
+
+    // greedy segmentation: a segment grows while some slope through its first cell
+    // keeps every cell within _maxError of the prediction. O(N)
+    // The segments are found through the directory, then one model evaluation bounds the search of the cell
+    _leaves.clear();
+    _leafFirst.clear();
+    int start = 0;
+    double slopeLo = 0;
+    double slopeHi = std::numeric_limits<double>::infinity();
+    auto close = [&](int last)
+    {
+        LinearModel leaf;
+        leaf.slope = std::isinf(slopeHi) ? 0 : (slopeLo + slopeHi) / 2;
+        leaf.intercept = start - leaf.slope * double(_cellFirst[start]);
+        // for _cellFirst[c] <= z < _cellFirst[c+1] the prediction lies between the ones of both ends
+        leaf.errLo = -_maxError - 1;
+        leaf.errHi = _maxError;
+        leaf.first = start;
+        leaf.last = last;
+        _leaves.push_back(leaf);
+        _leafFirst.push_back(_cellFirst[start]);
+    };
+    for (int c = start + 1; c < nCells; ++c)
+    {
+        const double dx = double(_cellFirst[c]) - double(_cellFirst[start]);
+        // keys too close for a double, e.g. large integers, start a new segment
+        if (dx <= 0)
+        {
+            close(c - 1);
+            start = c;
+            slopeLo = 0;
+            slopeHi = std::numeric_limits<double>::infinity();
+            continue;
+        }
+        const double lo = std::max(slopeLo, (c - start - _maxError) / dx);
+        const double hi = std::min(slopeHi, (c - start + _maxError) / dx);
+        if (lo <= hi)
+        {
+            slopeLo = lo;
+            slopeHi = hi;
+            continue;
+        }
+        close(c - 1);
+        start = c;
+        slopeLo = 0;
+        slopeHi = std::numeric_limits<double>::infinity();
+    }
+    close(nCells - 1);
+
+    setDirectory(_leafFirst);
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::LinearModel::search(ArrayView<Key> keys, Key z) const
+{
+    // bounded search, widened by one against rounding
+    const double prediction = predict(double(z));
+    const int lo = std::clamp(std::floor(prediction + errLo) - 1, first * 1., last * 1.);
+    const int hi = std::clamp(std::ceil(prediction + errHi) + 1, lo * 1., last * 1.);
+    return std::upper_bound(keys.begin() + lo + 1, keys.begin() + hi + 1, z) - keys.begin() - 1;
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::searchDirectory(ArrayView<Key> keys, Key z) const
+{
+    const auto directory = getDirectoryView();
+    const int nSlots = directory.size() - 1;
+    int slot = (double(z) - double(_lowerBound)) / _slotWidth;
+    slot = slot < nSlots ? slot : nSlots - 1;
+    slot = slot > -1 ? slot : 0;
+
+    // candidates are [last key of the previous slots, last key of this slot]
+    const int lo = directory[slot] > 0 ? directory[slot] - 1 : 0;
+    const int hi = directory[slot + 1] > 0 ? directory[slot + 1] - 1 : 0;
+    return std::upper_bound(keys.begin() + lo + 1, keys.begin() + hi + 1, z) - keys.begin() - 1;
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::getKey(Key z) const
+{
+    if (_bucketing == Bucketing::Uniform)
+    {
+        if constexpr (std::is_integral_v<Key>)
+        {
+            // exact: the offset from the lower bound is shifted by log2 of the cell width
+            if (z < _lowerBound)
+                return -1;
+            const Distance<Key> key = getDistance(z, _lowerBound) >> _shift;
+            return key < Distance<Key>(std::numeric_limits<int>::max()) ? int(key) : std::numeric_limits<int>::max();
+        }
+        else
+            return (z - _lowerBound) / _deltaZ;
+    }
+    else if (_bucketing == Bucketing::Quantile)
+        return searchDirectory(getCellFirstView(), z);
+    else
+        return getLeafView()[searchDirectory(getLeafFirstView(), z)].search(getCellFirstView(), z);
+}
+
+template <typename Key, typename Id, int BatchSize>
+const typename FastContainer<Key, Id, BatchSize>::Range FastContainer<Key, Id, BatchSize>::getClosestId(Key z) const
+{
+    sampleQuery(z);
+    return findClosestId<true>(z);
+}
+
+template <typename Key, typename Id, int BatchSize>
+template <bool Count>
+const typename FastContainer<Key, Id, BatchSize>::Range FastContainer<Key, Id, BatchSize>::findClosestId(Key z) const
+{
+    // the cell of the clamped z, the distances are taken to z itself
+    const auto cells = getCellView();
+    const int key = getClampedKey(z);
+    if (_candidates.empty() || _candidates.size() != cells.size())
+        return getClosestIdInCell<Count>(key, z);
+
+    const Cell& p = cells[key];
+    const Candidates& c = _candidates[key];
+    const int size = p.getSize();
+    const auto& values = p.getValues();
+
+    // The rank of z splits the cell: the nearest value is the last one below z or the first one from z on,
+    // the candidates stand in beyond the ends. Ties keep the lower slot, the left candidate wins only when it is
+    // strictly closer, as in the checked search
+    const int rank = getRank<false>(p, z);
+    const int lSlot = rank > 0 ? rank - 1 : 0;
+    const int rSlot = rank < size ? rank : 0;
+    const Key lValue = selectKey(rank > 0, values[lSlot], c.left);
+    const Key rValue = selectKey(rank < size, values[rSlot], c.right);
+    const Distance<Key> lDist = getUncheckedDistance(z, lValue);
+    const Distance<Key> rDist = getUncheckedDistance(z, rValue);
+    const bool left = lDist < rDist || (lDist == rDist && rank > 0);
+
+    // the answer is picked by an index, not by nested selects
+    const std::pair<int, int>* answers[4] = {&cells[c.rightCell].getIndices()[c.rightSlot], &p.getIndices()[rSlot],
+                                              &cells[c.leftCell].getIndices()[c.leftSlot], &p.getIndices()[lSlot]};
+    const std::pair<int, int>& pos = *answers[left ? 2 + int(rank > 0) : int(rank < size)];
+
+#ifdef FASTCONTAINER_COUNTERS
+    countBranch<Count>(size == 0 ? EmptyCell : (z < values[0] ? LeftOfCell : (z > values[size - 1] ? RightOfCell : InCell)));
+#endif
+    const auto ids = getIdView();
+    return {ids.begin() + pos.first, ids.begin() + pos.second + 1};
+}
+
+template <typename Key, typename Id, int BatchSize>
+const typename FastContainer<Key, Id, BatchSize>::Range FastContainer<Key, Id, BatchSize>::getClosestIdChecked(Key z) const
+{
+    sampleQuery(z);
+    const int key = getKey(z);
+    if (key < 0 || key >= _nKeys)
+        throw std::out_of_range("Value is outside of the cells");
+    return getClosestIdInCell(followOverflow(key, z), z);
+}
+
+template <typename Key, typename Id, int BatchSize>
+template <bool Count>
+const typename FastContainer<Key, Id, BatchSize>::Range FastContainer<Key, Id, BatchSize>::getClosestIdInCell(int key, Key z) const
+{
+    const auto cells = getCellView();
+    const auto ids = getIdView();
+
+    const auto& p =cells.at(key);
+
+    if (p.getSize() == 0)
+    {
+        countBranch<Count>(EmptyCell);
+        const int lID = p.getLNearest();
+        const int rID = p.getRNearest();
+        if (lID > -1 && rID > -1)
+        {
+            auto pos = getDistance(z, cells.at(lID).getLast()) < getDistance(cells.at(rID).getFirst(), z) ?  cells.at(lID).getLastIDpos() : cells.at(rID).getFirstIDpos();
+            return {ids.begin() + pos.first, std::next(ids.begin() + pos.second)};
+        }
+        else if (lID > -1 && rID == -1)
+        {
+            auto pos = cells.at(lID).getLastIDpos();
+            return {ids.begin() + pos.first, std::next(ids.begin() + pos.second)};
+        }
+        else if (lID == -1 && rID > -1)
+        {
+            auto pos = cells.at(rID).getFirstIDpos();
+            return {ids.begin() + pos.first, std::next(ids.begin() + pos.second)};
+        }
+    }
+
+    if (z < p.getFirst())
+    {
+        countBranch<Count>(LeftOfCell);
+        const int lID = p.getLNearest();
+        auto pos = lID > -1 && getDistance(z, cells.at(lID).getLast()) < getDistance(p.getFirst(), z) ?  cells.at(lID).getLastIDpos() : p.getFirstIDpos();
+        return {ids.begin() + pos.first, std::next(ids.begin() + pos.second)};
+    }
+    else if (z > p.getLast())
+    {
+        countBranch<Count>(RightOfCell);
+        const int rID = p.getRNearest();
+        auto pos = rID > -1 && getDistance(z, p.getLast()) > getDistance(cells.at(rID).getFirst(), z) ? cells.at(rID).getFirstIDpos() : p.getLastIDpos();
+        return {ids.begin() + pos.first, std::next(ids.begin() + pos.second)};
+    }
+
+    countBranch<Count>(InCell);
+
+    auto values = p.getValues();
+    auto begin = values.begin();
+    auto end = values.begin() + p.getSize();
+    auto it = std::min_element(begin, end, [&z](const auto& lhs, const auto& rhs){
+        return getDistance(lhs, z) < getDistance(rhs, z);
+    });
+    // TODO: lower_bound has O(lnN) for sorted elems.
+    auto id = std::distance(values.begin(), it);
+
+    auto pos = p.getIndices().at(id);
+    return {ids.begin() + pos.first, std::next(ids.begin() + pos.second)};
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::getClosestIds(const std::vector<Key>& queries, std::vector<Id>& out) const
+{
+    out.resize(queries.size());
+    getClosestIds(queries.data(), queries.size(), out.data());
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::getClosestIds(const std::vector<Key>& queries, std::vector<Id>& out, ThreadPool& pool) const
+{
+    // chunks of consecutive queries, each one runs the pipeline on its own
+    out.resize(queries.size());
+    pool.forEachChunk(queries.size(), _bulkChunk, [&](size_t begin, size_t end)
+    {
+        getClosestIds(queries.data() + begin, end - begin, out.data() + begin);
+    });
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::getIdsInRanges(ArrayView<Interval> intervals, std::vector<Range>& out, ThreadPool& pool) const
+{
+    // every chunk is one forEachInRanges call over its intervals
+    out.resize(intervals.size());
+    pool.forEachChunk(intervals.size(), _bulkChunk, [&](size_t begin, size_t end)
+    {
+        forEachInRanges(ArrayView<Interval>(intervals.data() + begin, end - begin), [&](size_t idx, const_iterator first, const_iterator last)
+        {
+            out[begin + idx] = {first, last};
+        });
+    });
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::getClosestIds(const Key* queries, int nQueries, Id* out) const
+{
+    const auto cells = getCellView();
+
+    // cells resident in cache gain nothing from prefetching
+    if (cells.size() * sizeof(Cell) < _pipelineMinBytes)
+    {
+        for (int i = 0; i < nQueries; ++i)
+            out[i] = *getClosestId(queries[i]).first;
+        return;
+    }
+
+    // Lookups run as a software pipeline over groups of _groupSize queries:
+    // group g prefetches its cells, group g-1 prefetches the neighbour cells it will fall back to,
+    // group g-2 is resolved and group g-3 reads its ids. Every stage touches memory requested
+    // one stage earlier, so the misses of a whole group overlap instead of being paid one by one.
+    // With the candidates of getClosestId the neighbours are not read, their candidates are prefetched with the cell
+    const int nGroups = (nQueries + _groupSize - 1) / _groupSize;
+    const bool candidates = !_candidates.empty() && _candidates.size() == cells.size();
+
+    auto cellKey = [&](int i)
+    {
+        const int key = getKey(queries[i]);
+        return key > -1 && key < _nKeys ? key : -1;
+    };
+
+    auto prefetchCell = [&](int key)
+    {
+        const char* cell = reinterpret_cast<const char*>(&cells[key]);
+        __builtin_prefetch(cell);
+        __builtin_prefetch(cell + sizeof(Cell) - 1);
+        if (candidates)
+            __builtin_prefetch(&_candidates[key]);
+    };
+
+    std::array<std::array<int, _groupSize>, 2> keys;
+    std::array<std::array<const_iterator, _groupSize>, 2> pending;
+
+    for (int g = 0; g < nGroups + 3; ++g)
+    {
+        // stage 0: cells
+        if (g < nGroups)
+        {
+            auto& k = keys[g & 1];
+            for (int i = g * _groupSize, j = 0; i < std::min((g + 1) * _groupSize, nQueries); ++i, ++j)
+            {
+                k[j] = cellKey(i);
+                if (k[j] > -1)
+                    prefetchCell(k[j]);
+            }
+        }
+
+        // stage 1: neighbour cells for queries outside of the occupied part of their cell
+        if (!candidates && g > 0 && g - 1 < nGroups)
+        {
+            const auto& k = keys[(g - 1) & 1];
+            for (int i = (g - 1) * _groupSize, j = 0; i < std::min(g * _groupSize, nQueries); ++i, ++j)
+            {
+                if (k[j] == -1)
+                    continue;
+
+                const auto& p = cells[k[j]];
+                const Key z = queries[i];
+                const int lID = p.getSize() == 0 || z < p.getFirst() ? p.getLNearest() : -1;
+                const int rID = p.getSize() == 0 || z > p.getLast() ? p.getRNearest() : -1;
+                if (lID > -1)
+                    prefetchCell(lID);
+                if (rID > -1)
+                    prefetchCell(rID);
+            }
+        }
+
+        // stage 2: resolve, the result is read from ids one stage later
+        if (g > 1 && g - 2 < nGroups)
+        {
+            auto& its = pending[g & 1];
+            for (int i = (g - 2) * _groupSize, j = 0; i < std::min((g - 1) * _groupSize, nQueries); ++i, ++j)
+            {
+                its[j] = getClosestId(queries[i]).first;
+                __builtin_prefetch(&*its[j]);
+            }
+        }
+
+        // stage 3: ids
+        if (g > 2)
+        {
+            const auto& its = pending[(g - 1) & 1];
+            for (int i = (g - 3) * _groupSize, j = 0; i < std::min((g - 2) * _groupSize, nQueries); ++i, ++j)
+                out[i] = *its[j];
+        }
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+template <typename Visitor>
+void FastContainer<Key, Id, BatchSize>::walkNearest(const std::vector<Key>& queries, Visitor visitor, ThreadPool* pool) const
+{
+    const auto cells = getCellView();
+    if (cells.size() == 0 || queries.empty())
+        return;
+
+    // queries by value, unsorted ones through radix sorted (value, index) pairs. Readers may share the container,
+    // so the pairs and the sort buffers belong to the calling thread, not to its scratch
+    static thread_local std::vector<std::pair<Key, size_t>> order;
+    static thread_local std::vector<std::pair<Key, size_t>> buffer;
+    static thread_local std::vector<std::array<size_t, 256>> histograms;
+    const bool sorted = std::is_sorted(queries.begin(), queries.end());
+    if (!sorted)
+    {
+        order.resize(queries.size());
+        for (size_t idx = 0; idx < queries.size(); ++idx)
+            order[idx] = {queries[idx], idx};
+        radixSort(order, buffer, histograms, [](const std::pair<Key, size_t>& elem){ return orderedBits(elem.first); },
+                  pool != nullptr ? pool->getNThreads() : 1, pool);
+    }
+
+    const int lastCell = getLastCell();
+    int key = -2;
+    for (size_t step = 0; step < queries.size(); ++step)
+    {
+        const size_t idx = sorted ? step : order[step].second;
+        const Key z = sorted ? queries[step] : order[step].first;
+
+        // key is the first filled cell with a value >= z, -1 once z is after all values.
+        // The queries only grow, so it moves forward from the cell of the previous query
+        if (key != -1)
+        {
+            key = key == -2 ? getClampedKey(z) : stepForward(key, z);
+            if (key > -1 && (cells[key].getSize() == 0 || cells[key].getLast() < z))
+                key = cells[key].getRNearest();
+        }
+        if (key == -1)
+        {
+            visitor(idx, lastCell, cells[lastCell].getSize() - 1);
+            continue;
+        }
+
+        // the first value >= z against the value before it, in the cell or at the end of the left neighbour
+        const auto& p = cells[key];
+        const auto& values = p.getValues();
+        const int slot = getRank<false>(p, z);
+        const int lCell = slot > 0 ? key : p.getLNearest();
+        const int lSlot = slot > 0 ? slot - 1 : (lCell > -1 ? cells[lCell].getSize() - 1 : -1);
+        if (lCell > -1 && getDistance(z, cells[lCell].getValues()[lSlot]) <= getDistance(values[slot], z))
+            visitor(idx, lCell, lSlot);
+        else
+            visitor(idx, key, slot);
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::nearestJoin(const std::vector<Key>& queries, std::vector<Id>& out, ThreadPool* pool) const
+{
+    if (isEmpty())
+        throw std::logic_error("Container is empty");
+
+    const auto cells = getCellView();
+    const auto ids = getIdView();
+    out.resize(queries.size());
+    walkNearest(queries, [&](size_t idx, int cell, int slot)
+    {
+        out[idx] = ids[cells[cell].getIndices()[slot].first];
+    }, pool);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::nearestJoin(const std::vector<Key>& queries, Distance<Key> eps, std::vector<std::pair<size_t, Id>>& out, ThreadPool* pool) const
+{
+    const auto cells = getCellView();
+    const auto ids = getIdView();
+    out.clear();
+    walkNearest(queries, [&](size_t idx, int cell, int slot)
+    {
+        const auto& p = cells[cell];
+        if (getDistance(queries[idx], p.getValues()[slot]) <= eps)
+            out.emplace_back(idx, ids[p.getIndices()[slot].first]);
+    }, pool);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::getKClosest(Key z, int k, std::vector<Id>& out) const
+{
+    const auto cells = getCellView();
+    const auto ids = getIdView();
+    out.clear();
+    if (isEmpty() || k <= 0)
+        return;
+
+    // two cursors (cell, value in cell) walk away from z: left over the values < z, right over the values >= z
+    const int key = getClampedKey(z);
+    const auto& p = cells[key];
+
+    int lCell = p.getLNearest();
+    int rCell = p.getRNearest();
+    int lIdx = lCell > -1 ? cells[lCell].getSize() - 1 : -1;
+    int rIdx = 0;
+    if (p.getSize() != 0)
+    {
+        const int idx = getRank<false>(p, z);
+        if (idx > 0)
+        {
+            lCell = key;
+            lIdx = idx - 1;
+        }
+        if (idx < p.getSize())
+        {
+            rCell = key;
+            rIdx = idx;
+        }
+    }
+
+    // merge both sides by distance, every step takes the run of ids of one value
+    while (out.size() < k && (lCell > -1 || rCell > -1))
+    {
+        const bool left = rCell == -1 ||
+            (lCell > -1 && getDistance(z, cells[lCell].getValues()[lIdx]) <= getDistance(cells[rCell].getValues()[rIdx], z));
+        const auto& cell = cells[left ? lCell : rCell];
+        const auto& pos = cell.getIndices()[left ? lIdx : rIdx];
+        for (int idx = pos.first; idx <= pos.second && out.size() < k; ++idx)
+            out.push_back(ids[idx]);
+
+        if (left && --lIdx < 0)
+        {
+            lCell = cell.getLNearest();
+            lIdx = lCell > -1 ? cells[lCell].getSize() - 1 : -1;
+        }
+        else if (!left && ++rIdx == cell.getSize())
+        {
+            rCell = cell.getRNearest();
+            rIdx = 0;
+        }
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::getClampedKey(Key z) const
+{
+    if (_nKeys == 0)
+        return -1;
+    const int key = getKey(std::clamp(z, _lowerBound, _upperBound));
+    return followOverflow(std::clamp(key, 0, _nKeys - 1), z);
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::followOverflow(int key, Key z) const
+{
+    // the cells of a chain are filled and ordered, z belongs to the first one reaching it or to the last one
+    const auto cells = getCellView();
+    while (cells[key].getNext() > -1 && cells[key].getLast() < z)
+        key = cells[key].getNext();
+    return key;
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::getLastCell() const
+{
+    const auto cells = getCellView();
+    int key = _nKeys - 1;
+    if (cells[key].getSize() == 0)
+        return cells[key].getLNearest();
+    while (cells[key].getNext() > -1)
+        key = cells[key].getNext();
+    return key;
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::stepForward(int key, Key z) const
+{
+    // the values of the cells before key are below z, so z belongs to key or to the next filled cell,
+    // otherwise the cell is found from scratch
+    const auto cells = getCellView();
+    const auto& p = cells[key];
+    if (p.getSize() > 0 && !(p.getLast() < z))
+        return key;
+
+    const int next = p.getRNearest();
+    if (next == -1 || !(cells[next].getLast() < z))
+        return next;
+    return getClampedKey(z);
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::getLowerPos(int key, Key z) const
+{
+    const auto cells = getCellView();
+    const int nIds = getIdView().size();
+    if (key == -1)
+        return nIds;
+
+    const auto& p = cells[key];
+    if (p.getSize() == 0)
+        return p.getRNearest() == -1 ? nIds : cells[p.getRNearest()].getFirstIDpos().first;
+
+    const int lDist = getRank<false>(p, z);
+    return lDist < p.getSize() ? p.getIndices()[lDist].first : std::min(p.getLastIDpos().second + 1, nIds);
+}
+
+template <typename Key, typename Id, int BatchSize>
+int FastContainer<Key, Id, BatchSize>::getUpperPos(int key, Key z) const
+{
+    const auto cells = getCellView();
+    const int nIds = getIdView().size();
+    if (key == -1)
+        return nIds;
+
+    const auto& p = cells[key];
+    if (p.getSize() == 0)
+        return p.getLNearest() == -1 ? 0 : cells[p.getLNearest()].getLastIDpos().second + 1;
+
+    const int rDist = getRank<true>(p, z);
+    return rDist < p.getSize() ? p.getIndices()[rDist].first : std::min(p.getLastIDpos().second + 1, nIds);
+}
+
+template <typename Key, typename Id, int BatchSize>
+const typename FastContainer<Key, Id, BatchSize>::Range FastContainer<Key, Id, BatchSize>::getIdsInRange(Key lowerZ, Key upperZ) const
+{
+    const auto ids = getIdView();
+    const int first = getLowerPos(getClampedKey(lowerZ), lowerZ);
+    const int last = getUpperPos(getClampedKey(upperZ), upperZ);
+
+    if (first < last)
+        return {ids.begin() + first, ids.begin() + last};
+    else
+        return {ids.end(), ids.end()};
+}
+
+template <typename Key, typename Id, int BatchSize>
+template <typename Visitor>
+void FastContainer<Key, Id, BatchSize>::forEachInRanges(ArrayView<Interval> intervals, Visitor visitor) const
+{
+    const auto ids = getIdView();
+    if (isEmpty())
+    {
+        for (size_t idx = 0; idx < intervals.size(); ++idx)
+            visitor(idx, ids.end(), ids.end());
+        return;
+    }
+
+    // intervals by their lower ends, unsorted ones through an order of their indices
+    std::vector<size_t> order;
+    const bool sorted = std::is_sorted(intervals.begin(), intervals.end(), [](const Interval& lhs, const Interval& rhs){
+        return lhs.first < rhs.first;
+    });
+    if (!sorted)
+    {
+        order.resize(intervals.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&intervals](size_t lhs, size_t rhs){
+            return intervals[lhs].first < intervals[rhs].first;
+        });
+    }
+
+    // The lower ends only grow, so their cell moves forward from the previous one. The upper ends
+    // move forward as well while they grow, a smaller one is looked up from scratch
+    int lowerKey = -1;
+    int upperKey = -1;
+    Key previousUpper = Key();
+    for (size_t step = 0; step < intervals.size(); ++step)
+    {
+        const size_t idx = sorted ? step : order[step];
+        const auto& [lowerZ, upperZ] = intervals[idx];
+
+        lowerKey = lowerKey == -1 ? getClampedKey(lowerZ) : stepForward(lowerKey, lowerZ);
+        const int first = getLowerPos(lowerKey, lowerZ);
+        if (lowerKey == -1)
+            lowerKey = getLastCell();
+
+        upperKey = upperKey == -1 || upperZ < previousUpper ? getClampedKey(upperZ) : stepForward(upperKey, upperZ);
+        const int last = getUpperPos(upperKey, upperZ);
+        if (upperKey == -1)
+            upperKey = getLastCell();
+        previousUpper = upperZ;
+
+        if (first < last)
+            visitor(idx, ids.begin() + first, ids.begin() + last);
+        else
+            visitor(idx, ids.end(), ids.end());
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+ContainerStats FastContainer<Key, Id, BatchSize>::getStats() const
+{
+    const auto cells = getCellView();
+    ContainerStats stats;
+    stats.nCells = cells.size();
+    stats.nIds = getIdView().size();
+    stats.memoryUsage = getMemoryUsage();
+    stats.occupancy.assign(BatchSize + 1, 0);
+
+    size_t gap = 0;
+    for (const auto& p: cells)
+    {
+        ++stats.occupancy[p.getSize()];
+        stats.nValues += p.getSize();
+        gap = p.getSize() == 0 ? gap + 1 : 0;
+        stats.longestEmptyGap = std::max(stats.longestEmptyGap, gap);
+
+        for (int idx = 0; idx < p.getSize(); ++idx)
+        {
+            const size_t run = p.getIndices()[idx].second - p.getIndices()[idx].first + 1;
+            const size_t bin = getFloorLog2(run);
+            if (stats.duplicateRuns.size() <= bin)
+                stats.duplicateRuns.resize(bin + 1, 0);
+            ++stats.duplicateRuns[bin];
+            stats.longestDuplicateRun = std::max(stats.longestDuplicateRun, run);
+        }
+    }
+    return stats;
+}
+
+template <typename Key, typename Id, int BatchSize>
+QueryCounters FastContainer<Key, Id, BatchSize>::getQueryCounters() const
+{
+    QueryCounters counters;
+#ifdef FASTCONTAINER_COUNTERS
+    counters.emptyCell = _counters[EmptyCell].value.load(std::memory_order_relaxed);
+    counters.leftOfCell = _counters[LeftOfCell].value.load(std::memory_order_relaxed);
+    counters.rightOfCell = _counters[RightOfCell].value.load(std::memory_order_relaxed);
+    counters.inCell = _counters[InCell].value.load(std::memory_order_relaxed);
+#endif
+    return counters;
+}
+
+template <typename Key, typename Id, int BatchSize>
+std::vector<Key> FastContainer<Key, Id, BatchSize>::getQuerySample() const
+{
+    std::vector<Key> sample;
+#ifdef FASTCONTAINER_COUNTERS
+    const uint64_t nSampled = (_nQueries.value.load(std::memory_order_relaxed) + _sampleStride - 1) / _sampleStride;
+    sample.reserve(std::min<uint64_t>(nSampled, _sampleSize));
+    for (size_t idx = 0; idx < std::min<uint64_t>(nSampled, _sampleSize); ++idx)
+        sample.push_back(_sampledQueries[idx].value.load(std::memory_order_relaxed));
+#endif
+    return sample;
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::resetQueryCounters()
+{
+#ifdef FASTCONTAINER_COUNTERS
+    for (auto& counter: _counters)
+        counter.value.store(0, std::memory_order_relaxed);
+    _nQueries.value.store(0, std::memory_order_relaxed);
+#endif
+}
+
+template <typename Key, typename Id, int BatchSize>
+TuningReport FastContainer<Key, Id, BatchSize>::tune(const std::vector<std::pair<Id, Key>>& input, const std::vector<Key>& queries, size_t memoryBudget)
+{
+    if (queries.empty())
+        throw std::invalid_argument("Empty query sample");
+
+    // distinct values, to skip uniform cells too many to allocate before they are built
+    std::vector<Key> values;
+    values.reserve(input.size());
+    for (const auto& elem: input)
+        values.push_back(elem.second);
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+
+    // BatchSize bounds the cells in memory, fewer values per cell give more and narrower cells.
+    // The candidates are measured with the checked search
+    TuningReport report;
+    const Bucketing bucketing0 = _bucketing;
+    const int maxSize0 = _maxSize;
+    const bool kernel0 = _kernel;
+    setKernel(false);
+    for (const Bucketing bucketing: {Bucketing::Uniform, Bucketing::Quantile, Bucketing::Learned})
+    {
+        for (int maxSize = 2; maxSize <= BatchSize; ++maxSize)
+        {
+            if (bucketing == Bucketing::Uniform && values.size() > maxSize)
+            {
+                const Distance<Key> delta = getMinSpan(values, maxSize, _nThreads, getBuildPool(values.size()));
+                const double nCells = delta > 0 ? double(getDistance(_upperBound, _lowerBound)) / delta : 1;
+                if (nCells * sizeof(Cell) > memoryBudget || nCells > _maxCellsPerValue * double(values.size()))
+                    continue;
+            }
+
+            _bucketing = bucketing;
+            _maxSize = maxSize;
+            try
+            {
+                set(input);
+            }
+            catch (const std::exception&)
+            {
+                _bucketing = bucketing0;
+                _maxSize = maxSize0;
+                continue;
+            }
+            report.candidates.push_back({bucketing, maxSize, getNCells(), getMemoryUsage(), predictProbeNs(queries), measureProbeNs(queries)});
+        }
+    }
+
+    double best = std::numeric_limits<double>::infinity();
+    for (const auto& candidate: report.candidates)
+    {
+        if (candidate.memoryUsage <= memoryBudget)
+            best = std::min(best, candidate.predictedNs);
+    }
+    for (int idx = 0; idx < report.candidates.size(); ++idx)
+    {
+        const auto& candidate = report.candidates[idx];
+        if (candidate.memoryUsage <= memoryBudget && candidate.predictedNs <= best * 1.05
+            && (report.chosen == -1 || candidate.memoryUsage < report.candidates[report.chosen].memoryUsage))
+            report.chosen = idx;
+    }
+    // the cells are those of the last candidate built, or of a failed build: rebuild with the settings it had
+    if (report.chosen == -1)
+    {
+        _bucketing = bucketing0;
+        _maxSize = maxSize0;
+        setKernel(kernel0);
+        set(input);
+        throw std::runtime_error("No configuration fits the memory budget");
+    }
+
+    _bucketing = report.candidates[report.chosen].bucketing;
+    _maxSize = report.candidates[report.chosen].maxSize;
+    set(input);
+
+    // the kernel stays on only with a measured win, within the same 5% it is not worth its candidates
+    report.checkedNs = measureProbeNs(queries);
+    setKernel(true);
+    report.kernelNs = measureProbeNs(queries);
+    report.kernel = hasKernel() && report.kernelNs < report.checkedNs * 0.95;
+    if (!report.kernel)
+        setKernel(false);
+    return report;
+}
+
+template <typename Key, typename Id, int BatchSize>
+double FastContainer<Key, Id, BatchSize>::predictProbeNs(const std::vector<Key>& queries) const
+{
+    // Lines read per query: the index of quantile and learned cells, the cell, the candidates or the neighbour
+    // cell of a query outside of the values of its cell, and the ids. The sample touches its distinct cells
+    // and id lines, they stay in cache if they fit
+    const auto cells = getCellView();
+    if (cells.size() == 0)
+        return 0;
+
+    const bool kernel = hasKernel();
+    const int cellLines = (sizeof(Cell) + 63) / 64;
+    const int lanes = getSimdLanes<Key>();
+    const int indexLines = _bucketing == Bucketing::Uniform ? 0 : 2;
+    std::vector<int> keys;
+    std::vector<size_t> idLines;
+    keys.reserve(queries.size());
+    idLines.reserve(queries.size());
+    double lines = 0;
+    double compares = 0;
+    for (const Key z: queries)
+    {
+        const int key = getClampedKey(z);
+        const auto& p = cells[key];
+        const bool outside = p.getSize() == 0 || z < p.getFirst() || z > p.getLast();
+        lines += indexLines + cellLines + 1 + (kernel ? 1 : (outside ? cellLines : 0));
+        compares += kernel ? (BatchSize + lanes - 1) / lanes + 2 : std::max(p.getSize(), 1) + int(outside);
+        keys.push_back(key);
+        idLines.push_back((findClosestId<false>(z).first - getIdView().begin()) * sizeof(Id) / 64);
+    }
+
+    std::sort(keys.begin(), keys.end());
+    std::sort(idLines.begin(), idLines.end());
+    const size_t nKeys = std::unique(keys.begin(), keys.end()) - keys.begin();
+    const size_t nIdLines = std::unique(idLines.begin(), idLines.end()) - idLines.begin();
+    const double hotBytes = nKeys * ((indexLines + cellLines) * 64. + (kernel ? sizeof(Candidates) : 0)) + nIdLines * 64.;
+    const CostModel& m = _costModel;
+    const double lineNs = m.hitNs + std::max(1 - m.l2Bytes / hotBytes, 0.) * m.l3Ns + std::max(1 - m.l3Bytes / hotBytes, 0.) * m.memoryNs;
+    return m.baseNs + m.indexNs[int(_bucketing)] + (lines * lineNs + compares * m.compareNs) / queries.size();
+}
+
+template <typename Key, typename Id, int BatchSize>
+double FastContainer<Key, Id, BatchSize>::measureProbeNs(const std::vector<Key>& queries) const
+{
+    // the first pass warms the caches as repeated queries do. The positions of the answers are summed and the
+    // sum handed to an empty asm statement, so the compiler cannot drop the searches
+    if (isEmpty())
+        return 0;
+
+    const Id* const ids = getIdView().begin();
+    size_t positions = 0;
+    for (const Key z: queries)
+        positions += findClosestId<false>(z).first - ids;
+    const auto start = std::chrono::steady_clock::now();
+    for (const Key z: queries)
+        positions += findClosestId<false>(z).first - ids;
+    const auto stop = std::chrono::steady_clock::now();
+    asm volatile("" : : "r"(positions));
+    return std::chrono::duration<double, std::nano>(stop - start).count() / queries.size();
+}
+
+template <typename Key, typename Id, int BatchSize>
+void FastContainer<Key, Id, BatchSize>::clearWeights()
+{
+    _prefixSums.clear();
+    _minTable.clear();
+    _maxTable.clear();
+}
+
+template <typename Key, typename Id, int BatchSize>
+template <typename WeightFn>
+void FastContainer<Key, Id, BatchSize>::setWeights(WeightFn weight)
+{
+    clearWeights();
+    const auto ids = getIdView();
+    const size_t n = ids.size();
+    _prefixSums.assign(n + 1, 0);
+    if (n == 0)
+        return;
+
+    _minTable.emplace_back(n);
+    for (size_t pos = 0; pos < n; ++pos)
+    {
+        _minTable[0][pos] = weight(ids[pos]);
+        _prefixSums[pos + 1] = _prefixSums[pos] + _minTable[0][pos];
+    }
+    _maxTable.push_back(_minTable[0]);
+
+    // level l combines two windows of level l - 1
+    for (size_t width = 2; width <= n; width *= 2)
+    {
+        const auto& prevMin = _minTable.back();
+        const auto& prevMax = _maxTable.back();
+        std::vector<double> levelMin(n - width + 1);
+        std::vector<double> levelMax(n - width + 1);
+        for (size_t pos = 0; pos + width <= n; ++pos)
+        {
+            levelMin[pos] = std::min(prevMin[pos], prevMin[pos + width / 2]);
+            levelMax[pos] = std::max(prevMax[pos], prevMax[pos + width / 2]);
+        }
+        _minTable.push_back(std::move(levelMin));
+        _maxTable.push_back(std::move(levelMax));
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+size_t FastContainer<Key, Id, BatchSize>::countInRange(Key lowerZ, Key upperZ) const
+{
+    if (isEmpty())
+        return 0;
+
+    const auto [first, last] = getIdsInRange(lowerZ, upperZ);
+    return last - first;
+}
+
+template <typename Key, typename Id, int BatchSize>
+double FastContainer<Key, Id, BatchSize>::sumInRange(Key lowerZ, Key upperZ) const
+{
+    if (!hasWeights())
+        throw std::logic_error("Weights are not set");
+    if (isEmpty())
+        return 0;
+
+    const auto [first, last] = getIdsInRange(lowerZ, upperZ);
+    const auto begin = getIdView().begin();
+    return _prefixSums[last - begin] - _prefixSums[first - begin];
+}
+
+template <typename Key, typename Id, int BatchSize>
+std::pair<double, double> FastContainer<Key, Id, BatchSize>::minMaxInRange(Key lowerZ, Key upperZ) const
+{
+    if (!hasWeights())
+        throw std::logic_error("Weights are not set");
+    if (isEmpty())
+        return {std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+
+    const auto [first, last] = getIdsInRange(lowerZ, upperZ);
+    if (first == last)
+        return {std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+
+    // two windows of the largest power of two covering [lo, hi) together
+    const size_t lo = first - getIdView().begin();
+    const size_t hi = last - getIdView().begin();
+    const int level = getFloorLog2(hi - lo);
+    const size_t width = size_t(1) << level;
+    return {std::min(_minTable[level][lo], _minTable[level][hi - width]), std::max(_maxTable[level][lo], _maxTable[level][hi - width])};
+}
+
+template <typename T, int Size>
+void FastStructure<T, Size>::push_back(const int index, const T& value)
+{
+    int idx = -1;
+    for (int id = 0; id < _size; ++id)
+    {
+        if (value == _values[id])
+            idx = id;
+    }
+        
+    if (idx == -1)
+    {
+        idx = _size++;
+        _values[idx] = value;
+        _indices_pos[idx] = {index, index};
+    }
+    else
+    {
+        int key = _indices_pos[idx].second + 1;
+        _indices_pos[idx].second = index;
+    
+        if (key != _indices_pos[idx].second)
+            throw std::invalid_argument("Error in filling");
+    }
+}
+
+template <typename T, int Size>
+void FastStructure<T, Size>::push_back(const std::pair<int, int>& pos, const T& value)
+{
+    if (_size == _maxsize)
+        throw std::length_error("Cell is full");
+
+    _values[_size] = value;
+    _indices_pos[_size] = pos;
+    ++_size;
+}
+
+template <typename T, int Size>
+void FastStructure<T, Size>::insert(const int idx, const int index, const T& value)
+{
+    if (_size == _maxsize)
+        throw std::length_error("Cell is full");
+
+    for (int id = _size; id > idx; --id)
+    {
+        _values[id] = _values[id - 1];
+        _indices_pos[id] = _indices_pos[id - 1];
+    }
+    _values[idx] = value;
+    _indices_pos[idx] = {index, index};
+    ++_size;
+}
+
+template <typename T, int Size>
+void FastStructure<T, Size>::erase(const int idx)
+{
+    for (int id = idx; id < _size - 1; ++id)
+    {
+        _values[id] = _values[id + 1];
+        _indices_pos[id] = _indices_pos[id + 1];
+    }
+    --_size;
+    _values[_size] = T();
+    _indices_pos[_size] = {-1, -1};
+}
+
+template <typename T, int Size>
+void FastStructure<T, Size>::shift(const int firstFrom, const int lastFrom, const int delta)
+{
+    for (int id = 0; id < _size; ++id)
+    {
+        if (_indices_pos[id].first >= firstFrom)
+            _indices_pos[id].first += delta;
+        if (_indices_pos[id].second >= lastFrom)
+            _indices_pos[id].second += delta;
+    }
+}
+
+// common configurations are compiled once in FastContainer.cxx
+extern template class FastContainer<double>;
+extern template class FastContainer<float, uint32_t>;
+extern template class FastContainer<int64_t, uint32_t>;
+extern template class FastContainer<double, int, 8>;
+extern template class FastContainer<float, uint32_t, 16>;
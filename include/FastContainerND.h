@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Uniform grid over Dim axes for nearest point and box queries.
+// The points are kept in cell order (CSR as in CompactFastContainer): a cell is a contiguous run of
+// _points and _ids given by _offsets. The nearest point is searched in rings of cells around the
+// cell of the query, the search stops once no cell of the next ring can hold a closer point.
+template <int Dim, typename Key = double, typename Id = int, int BatchSize = 5>
+class FastContainerND
+{
+  static_assert(Dim > 0, "Dim must be positive");
+  static_assert(std::is_floating_point_v<Key>, "Key must be a floating point type");
+public:
+  using Point = std::array<Key, Dim>;
+  using CellIndex = std::array<int, Dim>;
+  using const_iterator = typename std::vector<Id>::const_iterator;
+
+private:
+  Point _lowerBound;
+  Point _upperBound;
+  Point _deltaZ;         // cell width per axis
+  CellIndex _nCells;     // cells per axis
+  CellIndex _strides;    // linear cell = sum of cell[axis] * _strides[axis]
+  std::vector<uint32_t> _offsets;
+  std::vector<Point> _points;
+  std::vector<Id> _ids;
+
+  CellIndex getCell(const Point& z) const;
+  int getLinear(const CellIndex& cell) const;
+  static Key getDistance2(const Point& lhs, const Point& rhs);
+  // calls fn(linear cell) for every cell at Chebyshev distance r from center
+  template <typename Fn>
+  void forEachInRing(const CellIndex& center, int r, int axis, CellIndex& cell, int linear, bool onRing, Fn& fn) const;
+public:
+  FastContainerND() = default;
+  FastContainerND(const Point& lowerBound, const Point& upperBound);
+  ~FastContainerND() = default;
+
+  void set(const std::vector<std::pair<Id, Point>>& input);
+  // id of the nearest point in euclidean distance, end of the ids if empty
+  const_iterator getClosestId(const Point& z) const;
+  // ids of the points inside of [lowerZ, upperZ] on every axis, in cell order. out is reused
+  void getIdsInBox(const Point& lowerZ, const Point& upperZ, std::vector<Id>& out) const;
+  inline bool isEmpty() const {return _ids.empty();};
+  inline size_t getNCells() const {return _offsets.empty() ? 0 : _offsets.size() - 1;};
+  inline const_iterator end() const {return _ids.end();};
+};
+
+template <int Dim, typename Key, typename Id, int BatchSize>
+FastContainerND<Dim, Key, Id, BatchSize>::FastContainerND(const Point& lowerBound, const Point& upperBound):
+    _lowerBound(lowerBound),
+    _upperBound(upperBound)
+{
+    // check bounds
+    for (int axis = 0; axis < Dim; ++axis)
+    {
+        if (upperBound[axis] <= lowerBound[axis])
+            throw std::invalid_argument("Incorrect upper and lower bounds");
+    }
+}
+
+template <int Dim, typename Key, typename Id, int BatchSize>
+void FastContainerND<Dim, Key, Id, BatchSize>::set(const std::vector<std::pair<Id, Point>>& input)
+{
+    _offsets.clear();
+    _points.clear();
+    _ids.clear();
+
+    if (input.empty())
+        return;
+
+    // check bounds against input
+    for (const auto& elem: input)
+    {
+        for (int axis = 0; axis < Dim; ++axis)
+        {
+            if (elem.second[axis] < _lowerBound[axis] || elem.second[axis] > _upperBound[axis])
+                throw std::invalid_argument("Input is out of range [lower, upper]");
+        }
+    }
+
+    // Cell size per axis. The 1D rule, BatchSize distinct values in the densest cell, would give
+    // (range / span)^Dim cells here, so the cells hold BatchSize points on average instead
+    const int perAxis = std::max<int>(1, std::ceil(std::pow(double(input.size()) / BatchSize, 1. / Dim)));
+    int stride = 1;
+    for (int axis = Dim - 1; axis >= 0; --axis)
+    {
+        _nCells[axis] = perAxis;
+        _deltaZ[axis] = (_upperBound[axis] - _lowerBound[axis]) / perAxis;
+        _strides[axis] = stride;
+        stride *= perAxis;
+    }
+
+    // counting sort by cell, the prefix sums are the offsets of the cells. O(N)
+    std::vector<int> linear(input.size());
+    _offsets.assign(stride + 1, 0);
+    for (int idx = 0; idx < input.size(); ++idx)
+    {
+        linear[idx] = getLinear(getCell(input[idx].second));
+        ++_offsets[linear[idx] + 1];
+    }
+    for (int cell = 0; cell < stride; ++cell)
+        _offsets[cell + 1] += _offsets[cell];
+
+    _points.resize(input.size());
+    _ids.resize(input.size());
+    std::vector<uint32_t> next(_offsets.begin(), _offsets.end() - 1);
+    for (int idx = 0; idx < input.size(); ++idx)
+    {
+        const uint32_t pos = next[linear[idx]]++;
+        _points[pos] = input[idx].second;
+        _ids[pos] = input[idx].first;
+    }
+}
+
+template <int Dim, typename Key, typename Id, int BatchSize>
+typename FastContainerND<Dim, Key, Id, BatchSize>::CellIndex FastContainerND<Dim, Key, Id, BatchSize>::getCell(const Point& z) const
+{
+    // cell of z, clamped to the grid
+    CellIndex cell;
+    for (int axis = 0; axis < Dim; ++axis)
+    {
+        const Key key = (z[axis] - _lowerBound[axis]) / _deltaZ[axis];
+        cell[axis] = key < 0 ? 0 : (key < _nCells[axis] ? int(key) : _nCells[axis] - 1);
+    }
+    return cell;
+}
+
+template <int Dim, typename Key, typename Id, int BatchSize>
+int FastContainerND<Dim, Key, Id, BatchSize>::getLinear(const CellIndex& cell) const
+{
+    int linear = 0;
+    for (int axis = 0; axis < Dim; ++axis)
+        linear += cell[axis] * _strides[axis];
+    return linear;
+}
+
+template <int Dim, typename Key, typename Id, int BatchSize>
+Key FastContainerND<Dim, Key, Id, BatchSize>::getDistance2(const Point& lhs, const Point& rhs)
+{
+    Key dist = 0;
+    for (int axis = 0; axis < Dim; ++axis)
+        dist += (lhs[axis] - rhs[axis]) * (lhs[axis] - rhs[axis]);
+    return dist;
+}
+
+template <int Dim, typename Key, typename Id, int BatchSize>
+template <typename Fn>
+void FastContainerND<Dim, Key, Id, BatchSize>::forEachInRing(const CellIndex& center, int r, int axis, CellIndex& cell, int linear, bool onRing, Fn& fn) const
+{
+    const int lo = std::max(center[axis] - r, 0);
+    const int hi = std::min(center[axis] + r, _nCells[axis] - 1);
+    for (int key = lo; key <= hi; ++key)
+    {
+        // the last axis only takes both ends, unless an earlier axis is on the ring already
+        const bool edge = key == center[axis] - r || key == center[axis] + r;
+        if (axis == Dim - 1 && !onRing && !edge)
+        {
+            key = center[axis] + r - 1;
+            continue;
+        }
+
+        cell[axis] = key;
+        if (axis == Dim - 1)
+            fn(linear + key * _strides[axis]);
+        else
+            forEachInRing(center, r, axis + 1, cell, linear + key * _strides[axis], onRing || edge, fn);
+    }
+}
+
+template <int Dim, typename Key, typename Id, int BatchSize>
+typename FastContainerND<Dim, Key, Id, BatchSize>::const_iterator FastContainerND<Dim, Key, Id, BatchSize>::getClosestId(const Point& z) const
+{
+    if (isEmpty())
+        return _ids.end();
+
+    const CellIndex center = getCell(z);
+    int maxRing = 0;
+    for (int axis = 0; axis < Dim; ++axis)
+        maxRing = std::max({maxRing, center[axis], _nCells[axis] - 1 - center[axis]});
+
+    int best = -1;
+    Key bestDist = std::numeric_limits<Key>::infinity();
+    auto visit = [&](int linear)
+    {
+        for (uint32_t pos = _offsets[linear]; pos < _offsets[linear + 1]; ++pos)
+        {
+            const Key dist = getDistance2(_points[pos], z);
+            if (dist < bestDist)
+            {
+                bestDist = dist;
+                best = pos;
+            }
+        }
+    };
+
+    CellIndex cell;
+    for (int r = 0; r <= maxRing; ++r)
+    {
+        forEachInRing(center, r, 0, cell, 0, r == 0, visit);
+
+        // distance from z to the outside of the searched box bounds every cell of the next rings
+        Key reach = std::numeric_limits<Key>::infinity();
+        for (int axis = 0; axis < Dim; ++axis)
+        {
+            if (center[axis] - r > 0)
+                reach = std::min(reach, z[axis] - (_lowerBound[axis] + (center[axis] - r) * _deltaZ[axis]));
+            if (center[axis] + r < _nCells[axis] - 1)
+                reach = std::min(reach, _lowerBound[axis] + (center[axis] + r + 1) * _deltaZ[axis] - z[axis]);
+        }
+        if (best > -1 && reach > 0 && bestDist <= reach * reach)
+            break;
+    }
+    return _ids.begin() + best;
+}
+
+template <int Dim, typename Key, typename Id, int BatchSize>
+void FastContainerND<Dim, Key, Id, BatchSize>::getIdsInBox(const Point& lowerZ, const Point& upperZ, std::vector<Id>& out) const
+{
+    out.clear();
+    if (isEmpty())
+        return;
+
+    for (int axis = 0; axis < Dim; ++axis)
+    {
+        if (upperZ[axis] < lowerZ[axis])
+            return;
+    }
+
+    // every cell of the box of cells is scanned, the points are checked on every axis
+    const CellIndex first = getCell(lowerZ);
+    const CellIndex last = getCell(upperZ);
+    CellIndex cell = first;
+    while (true)
+    {
+        const int linear = getLinear(cell);
+        for (uint32_t pos = _offsets[linear]; pos < _offsets[linear + 1]; ++pos)
+        {
+            bool inside = true;
+            for (int axis = 0; axis < Dim && inside; ++axis)
+                inside = _points[pos][axis] >= lowerZ[axis] && _points[pos][axis] <= upperZ[axis];
+            if (inside)
+                out.push_back(_ids[pos]);
+        }
+
+        // next cell of the box, the last axis runs fastest
+        int axis = Dim - 1;
+        while (axis >= 0 && cell[axis] == last[axis])
+        {
+            cell[axis] = first[axis];
+            --axis;
+        }
+        if (axis < 0)
+            break;
+        ++cell[axis];
+    }
+}
+
+// common configurations are compiled once in FastContainerND.cxx
+extern template class FastContainerND<2>;
+extern template class FastContainerND<3>;
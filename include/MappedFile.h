@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read only view of a contiguous array, owned by a vector or mapped from a file
+template <typename T>
+class ArrayView
+{
+private:
+  const T* _data = nullptr;
+  size_t _size = 0;
+public:
+  using value_type = T;
+
+  ArrayView() = default;
+  ArrayView(const T* data, size_t size): _data(data), _size(size) {};
+  template <typename Allocator>
+  ArrayView(const std::vector<T, Allocator>& vec): _data(vec.data()), _size(vec.size()) {};
+
+  inline const T* begin() const {return _data;};
+  inline const T* end() const {return _data + _size;};
+  inline const T* data() const {return _data;};
+  inline size_t size() const {return _size;};
+  inline bool empty() const {return _size == 0;};
+  inline const T& operator[](size_t idx) const {return _data[idx];};
+  inline const T& at(size_t idx) const
+  {
+    if (idx >= _size)
+      throw std::out_of_range("ArrayView index is out of range");
+    return _data[idx];
+  };
+};
+
+// Maps a whole file read only and shared between processes.
+// The mapping is released with the last copy of the returned pointer
+inline std::pair<std::shared_ptr<const void>, size_t> mapFile(const std::string& path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path);
+
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || status.st_size == 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Cannot map empty file " + path);
+    }
+
+    const size_t size = status.st_size;
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        throw std::runtime_error("Cannot map " + path);
+
+    return {std::shared_ptr<const void>(data, [size](const void* ptr){ ::munmap(const_cast<void*>(ptr), size); }), size};
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "FastContainer.h"
+#include "MappedFile.h"
+
+// FastContainer returning the records of the values instead of their ids: {value, id, payload} are stored
+// in the order of the values, at the positions of the ids of the inner container. A query returns the
+// records directly, there is no second random access from the id into a user array.
+// The inner container is built with the input position as id, which gives the permutation that puts
+// the records in order; they are moved in place along its cycles, so the payloads are never copied
+// to a second buffer. Built once by set(), there are no local updates.
+template <typename Key, typename Payload, typename Id = int, int BatchSize = 5>
+class PayloadFastContainer
+{
+  static_assert(std::is_trivially_copyable_v<Payload>, "Payload must be trivially copyable");
+public:
+  struct Record
+  {
+    Key value;
+    Id id;
+    Payload payload;
+  };
+  using Span = ArrayView<Record>;
+
+private:
+  FastContainer<Key, uint32_t, BatchSize> _container;
+  std::vector<Record> _records;
+
+  inline Span getSpan(const typename FastContainer<Key, uint32_t, BatchSize>::Range& range) const
+  {
+    return Span(_records.data() + (range.first - _container.begin()), range.second - range.first);
+  };
+public:
+  PayloadFastContainer(Key lowerBound, Key upperBound, Bucketing bucketing = Bucketing::Uniform);
+  ~PayloadFastContainer() = default;
+
+  // takes the records over and reorders them by value, equal values keep their order
+  void set(std::vector<Record>&& records);
+  // records of the nearest value. z outside of the bounds takes the nearest end, empty if there are no values
+  Span getClosest(Key z) const;
+  // records in [lowerZ, upperZ]
+  Span getInRange(Key lowerZ, Key upperZ) const;
+  inline bool isEmpty() const {return _records.empty();};
+  inline size_t getSize() const {return _records.size();};
+  inline Span getRecords() const {return Span(_records);};
+  inline size_t getMemoryUsage() const {return _container.getMemoryUsage() + _records.capacity() * sizeof(Record);};
+  inline int getNThreads() const {return _container.getNThreads();};
+  inline void setNThreads(int nThreads) {_container.setNThreads(nThreads);};
+};
+
+template <typename Key, typename Payload, typename Id, int BatchSize>
+PayloadFastContainer<Key, Payload, Id, BatchSize>::PayloadFastContainer(Key lowerBound, Key upperBound, Bucketing bucketing):
+    _container(lowerBound, upperBound, bucketing)
+{
+}
+
+template <typename Key, typename Payload, typename Id, int BatchSize>
+void PayloadFastContainer<Key, Payload, Id, BatchSize>::set(std::vector<Record>&& records)
+{
+    if (records.size() > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Too many records");
+
+    // the inner container checks the bounds, on failure the records stay with the caller
+    std::vector<std::pair<uint32_t, Key>> input;
+    input.reserve(records.size());
+    for (size_t idx = 0; idx < records.size(); ++idx)
+        input.emplace_back(idx, records[idx].value);
+    _container.set(std::move(input));
+    _records = std::move(records);
+
+    // perm[pos]: input position of the record that belongs to pos. Every cycle is moved through one temporary
+    std::vector<uint32_t> perm(_container.begin(), _container.end());
+    for (size_t start = 0; start < perm.size(); ++start)
+    {
+        if (perm[start] == start)
+            continue;
+
+        Record tmp = std::move(_records[start]);
+        size_t pos = start;
+        while (perm[pos] != start)
+        {
+            const size_t next = perm[pos];
+            _records[pos] = std::move(_records[next]);
+            perm[pos] = pos;
+            pos = next;
+        }
+        _records[pos] = std::move(tmp);
+        perm[pos] = pos;
+    }
+}
+
+template <typename Key, typename Payload, typename Id, int BatchSize>
+typename PayloadFastContainer<Key, Payload, Id, BatchSize>::Span PayloadFastContainer<Key, Payload, Id, BatchSize>::getClosest(Key z) const
+{
+    if (isEmpty())
+        return Span();
+    return getSpan(_container.getClosestId(z));
+}
+
+template <typename Key, typename Payload, typename Id, int BatchSize>
+typename PayloadFastContainer<Key, Payload, Id, BatchSize>::Span PayloadFastContainer<Key, Payload, Id, BatchSize>::getInRange(Key lowerZ, Key upperZ) const
+{
+    if (isEmpty())
+        return Span();
+    return getSpan(_container.getIdsInRange(lowerZ, upperZ));
+}
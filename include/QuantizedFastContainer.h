@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "FastContainer.h"
+#include "RadixSort.h"
+#include "SimdSearch.h"
+
+// Uniform cells as in FastContainer, with the values of a cell stored as 16 or 32 bit codes: the offset of the value
+// from the cell origin _lowerBound + key*_deltaZ in steps of _deltaZ / 2^bits. A cell is 24 bytes instead of 96 for
+// doubles and BatchSize 5, so much larger containers stay in cache:
+//   _cells   - codes of the distinct values of every cell, the links to the nearest filled cells
+//   _values  - distinct values in full precision, read only when the codes can not decide
+//   _runs    - position in _indices of the first id of every distinct value, the last entry is the number of ids
+// The rank of z in its cell is a compare of the codes. Values with the code of z are ordered by their full precision,
+// and the nearest of two candidates is decided by the codes unless their distances to z are within two steps.
+template <typename Key, typename Id = int, int BatchSize = 5, typename Code = uint16_t>
+class QuantizedFastContainer
+{
+  static_assert(std::is_arithmetic_v<Key> && !std::is_same_v<Key, bool>, "Key must be an arithmetic type");
+  static_assert(std::is_same_v<Code, uint16_t> || std::is_same_v<Code, uint32_t>, "Code must be a 16 or 32 bit unsigned integer");
+public:
+  using const_iterator = typename std::vector<Id>::const_iterator;
+  using Range = std::pair<const_iterator, const_iterator>;
+  static constexpr int CodeBits = 8 * sizeof(Code);
+
+  struct Cell
+  {
+    uint32_t first = 0; // index in _values of the first value, of the next value for an empty cell
+    int lID = -1;       // nearest filled cells, -1 if none
+    int rID = -1;
+    uint16_t size = 0;
+    std::array<Code, BatchSize> codes{}; // only the first size codes are set
+  };
+
+private:
+  Key _lowerBound;
+  Key _upperBound;
+  Distance<Key> _deltaZ = std::numeric_limits<Distance<Key>>::max();
+  int _shift = 0;     // integer keys: _deltaZ == 1 << _shift
+  int _codeShift = 0; // integer keys: a code is the offset >> _codeShift
+  double _invStep = 0;   // floating keys: a code is the offset * _invStep
+  double _cellSteps = 0; // steps per cell
+  bool _approximate = true; // false if a step is below the precision of Key, every candidate is then compared exactly
+  int _nThreads = std::max<int>(std::thread::hardware_concurrency(), 1); // used by set()
+  std::vector<Cell> _cells;
+  std::vector<Key> _values;
+  std::vector<uint32_t> _runs;
+  std::vector<Id> _indices;
+
+  int getKey(Key z) const;
+  // offset of z from the origin of cell key in steps, not rounded
+  double getOffset(Key z, int key) const;
+  Code getCode(double offset) const;
+  // index in _values of the first value >= z, or > z for OrEqual. z is in cell key at the given offset
+  template <bool OrEqual>
+  int getRank(Key z, int key, double offset) const;
+  template <bool OrEqual>
+  int getRank(Key z) const;
+public:
+  QuantizedFastContainer() = default;
+  QuantizedFastContainer(Key lowerBound, Key upperBound);
+  ~QuantizedFastContainer() = default;
+
+  void set(const std::vector<std::pair<Id, Key>>& input);
+  const Range getClosestId(Key z) const;
+  const Range getIdsInRange(Key lowerZ, Key upperZ) const;
+  inline bool isEmpty() const {return _values.empty();};
+  inline size_t getNCells() const {return _cells.size();};
+  inline bool isApproximate() const {return _approximate;};
+  size_t getMemoryUsage() const;
+  // bytes read by every lookup: the cells and the runs, without the full precision values
+  size_t getIndexMemoryUsage() const;
+  inline int getNThreads() const {return _nThreads;};
+  inline void setNThreads(int nThreads) {_nThreads = std::max(nThreads, 1);};
+};
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+QuantizedFastContainer<Key, Id, BatchSize, Code>::QuantizedFastContainer(Key lowerBound, Key upperBound):
+    _lowerBound(lowerBound),
+    _upperBound(upperBound)
+{
+    // check bounds
+    if (upperBound <= lowerBound)
+        throw std::invalid_argument("Incorrect upper and lower bounds");
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+void QuantizedFastContainer<Key, Id, BatchSize, Code>::set(const std::vector<std::pair<Id, Key>>& input)
+{
+    _cells.clear();
+    _values.clear();
+    _runs.clear();
+    _indices.clear();
+
+    if (input.empty())
+        return;
+
+    // sort by value, equal values keep the input order. O(N)
+    std::vector<std::pair<Id, Key>> sorted(input);
+    std::vector<std::pair<Id, Key>> buffer;
+    radixSort(sorted, buffer, [](const std::pair<Id, Key>& elem){ return orderedBits(elem.second); }, _nThreads);
+
+    // check bounds against input
+    if (sorted.front().second < _lowerBound || sorted.back().second > _upperBound)
+        throw std::invalid_argument("Input is out of range [lower, upper]");
+
+    // ids in order and the runs of the distinct values. O(N)
+    _indices.resize(sorted.size());
+    for (int idx = 0; idx < sorted.size(); ++idx)
+    {
+        _indices[idx] = sorted[idx].first;
+        if (_values.empty() || _values.back() != sorted[idx].second)
+        {
+            _values.push_back(sorted[idx].second);
+            _runs.push_back(idx);
+        }
+    }
+    _runs.push_back(sorted.size());
+    _values.shrink_to_fit();
+    _runs.shrink_to_fit();
+
+    // the cell width keeps at most BatchSize distinct values in a cell, as for FastContainer. O(N)
+    Distance<Key> delta = getDistance(_upperBound, _lowerBound);
+    if (_values.size() > BatchSize)
+    {
+        const Distance<Key> span = getMinSpan(_values, BatchSize, _nThreads);
+        delta = span > 0 ? span : delta;
+    }
+
+    size_t nCells = 0;
+    if constexpr (std::is_integral_v<Key>)
+    {
+        // exact codes: a cell narrower than 2^bits is not quantized at all
+        _shift = getFloorLog2(delta);
+        _deltaZ = Distance<Key>(1) << _shift;
+        _codeShift = std::max(_shift - CodeBits, 0);
+        _cellSteps = std::ldexp(1.0, _shift - _codeShift);
+        nCells = (getDistance(_upperBound, _lowerBound) >> _shift) + 1;
+    }
+    else
+    {
+        _deltaZ = delta;
+        _cellSteps = std::ldexp(1.0, CodeBits);
+        _invStep = _cellSteps / double(_deltaZ);
+        nCells = size_t((_upperBound - _lowerBound) / _deltaZ) + 1;
+        // the offsets are rounded to the precision of Key, a step must be well above it to order by the codes
+        const double magnitude = std::max(std::abs(double(_lowerBound)), std::abs(double(_upperBound)));
+        _approximate = double(_deltaZ) / _cellSteps > 16 * magnitude * std::numeric_limits<Key>::epsilon();
+    }
+
+    // codes of the cells. O(N)
+    _cells.assign(nCells, Cell());
+    for (int idx = 0; idx < _values.size(); ++idx)
+    {
+        const int key = getKey(_values[idx]);
+        Cell& cell = _cells[key];
+        if (cell.size == BatchSize)
+            throw std::length_error("Cell is full");
+        if (cell.size == 0)
+            cell.first = idx;
+        cell.codes[cell.size++] = getCode(getOffset(_values[idx], key));
+    }
+
+    // links to the nearest filled cells, an empty cell starts at the values of the next filled one. O(number of cells)
+    int lID = -1;
+    for (int key = 0; key < nCells; ++key)
+    {
+        _cells[key].lID = lID;
+        lID = _cells[key].size > 0 ? key : lID;
+    }
+    int rID = -1;
+    uint32_t next = _values.size();
+    for (int key = nCells - 1; key >= 0; --key)
+    {
+        Cell& cell = _cells[key];
+        cell.rID = rID;
+        if (cell.size > 0)
+        {
+            rID = key;
+            next = cell.first;
+        }
+        else
+            cell.first = next;
+    }
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+int QuantizedFastContainer<Key, Id, BatchSize, Code>::getKey(Key z) const
+{
+    // cell of z, clamped to the existing ones
+    const int last = _cells.size() - 1;
+    if (z <= _lowerBound)
+        return 0;
+
+    if constexpr (std::is_integral_v<Key>)
+    {
+        const Distance<Key> key = getDistance(z, _lowerBound) >> _shift;
+        return key < Distance<Key>(last) ? int(key) : last;
+    }
+    else
+    {
+        const Key key = (z - _lowerBound) / _deltaZ;
+        return key < last ? int(key) : last;
+    }
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+double QuantizedFastContainer<Key, Id, BatchSize, Code>::getOffset(Key z, int key) const
+{
+    if constexpr (std::is_integral_v<Key>)
+    {
+        // exact for z in the cell
+        const Distance<Key> offset = getDistance(z, _lowerBound) - (Distance<Key>(key) << _shift);
+        return std::ldexp(double(offset), -_codeShift);
+    }
+    else
+        return (double(z) - (double(_lowerBound) + key * double(_deltaZ))) * _invStep;
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+Code QuantizedFastContainer<Key, Id, BatchSize, Code>::getCode(double offset) const
+{
+    // rounding may put a value of the cell a few ulps outside of it
+    return Code(std::clamp(std::floor(offset), 0., _cellSteps - 1));
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+template <bool OrEqual>
+int QuantizedFastContainer<Key, Id, BatchSize, Code>::getRank(Key z, int key, double offset) const
+{
+    // the codes are monotonic in the value: a lower code is a lower value, only equal codes need the values
+    const Cell& cell = _cells[key];
+    const Code code = getCode(offset);
+    const int below = countBelow<false>(cell.codes.data(), BatchSize, cell.size, code);
+    const int notAbove = countBelow<true>(cell.codes.data(), BatchSize, cell.size, code);
+    if (below == notAbove)
+        return cell.first + below;
+
+    const auto begin = _values.begin() + cell.first + below;
+    const auto end = _values.begin() + cell.first + notAbove;
+    return (OrEqual ? std::upper_bound(begin, end, z) : std::lower_bound(begin, end, z)) - _values.begin();
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+template <bool OrEqual>
+int QuantizedFastContainer<Key, Id, BatchSize, Code>::getRank(Key z) const
+{
+    const Key zc = std::clamp(z, _lowerBound, _upperBound);
+    const int key = getKey(zc);
+    return getRank<OrEqual>(z, key, getOffset(zc, key));
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+const typename QuantizedFastContainer<Key, Id, BatchSize, Code>::Range QuantizedFastContainer<Key, Id, BatchSize, Code>::getClosestId(Key z) const
+{
+    if (isEmpty())
+        return {_indices.end(), _indices.end()};
+
+    // the nearest value is the first one >= z or the one before it
+    const Key zc = std::clamp(z, _lowerBound, _upperBound);
+    const int key = getKey(zc);
+    const double offset = getOffset(zc, key);
+    int idx = getRank<false>(z, key, offset);
+    if (idx > 0 && idx < _values.size())
+    {
+        // both candidates exist, so z is in range. Their positions in steps from the origin of cell key, a value
+        // lies in [code, code + 1) of its cell: the codes decide unless the distances are within two steps
+        const Cell& cell = _cells[key];
+        const int rank = idx - cell.first;
+        const int lKey = rank > 0 ? key : cell.lID;
+        const int rKey = rank < cell.size ? key : cell.rID;
+        const double lPos = (lKey - key) * _cellSteps + (rank > 0 ? cell.codes[rank - 1] : _cells[lKey].codes[_cells[lKey].size - 1]);
+        const double rPos = (rKey - key) * _cellSteps + (rank < cell.size ? cell.codes[rank] : _cells[rKey].codes[0]);
+        const double lDist = offset - lPos;
+        const double rDist = rPos - offset;
+
+        bool left = false;
+        if (_approximate && lDist < rDist - 0.25)
+            left = true;
+        else if (_approximate && lDist > rDist + 2.25)
+            left = false;
+        else
+            left = getDistance(z, _values[idx - 1]) <= getDistance(_values[idx], z);
+        idx -= left;
+    }
+    else if (idx == _values.size())
+        --idx;
+
+    return {_indices.begin() + _runs[idx], _indices.begin() + _runs[idx + 1]};
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+const typename QuantizedFastContainer<Key, Id, BatchSize, Code>::Range QuantizedFastContainer<Key, Id, BatchSize, Code>::getIdsInRange(Key lowerZ, Key upperZ) const
+{
+    if (isEmpty() || upperZ < lowerZ)
+        return {_indices.end(), _indices.end()};
+
+    return {_indices.begin() + _runs[getRank<false>(lowerZ)], _indices.begin() + _runs[getRank<true>(upperZ)]};
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+size_t QuantizedFastContainer<Key, Id, BatchSize, Code>::getMemoryUsage() const
+{
+    return getIndexMemoryUsage() + _values.capacity() * sizeof(Key) + _indices.capacity() * sizeof(Id);
+}
+
+template <typename Key, typename Id, int BatchSize, typename Code>
+size_t QuantizedFastContainer<Key, Id, BatchSize, Code>::getIndexMemoryUsage() const
+{
+    return sizeof(*this) + _cells.capacity() * sizeof(Cell) + _runs.capacity() * sizeof(uint32_t);
+}
+
+// common configurations are compiled once in QuantizedFastContainer.cxx
+extern template class QuantizedFastContainer<double>;
+extern template class QuantizedFastContainer<double, int, 5, uint32_t>;
+extern template class QuantizedFastContainer<float, uint32_t>;
+extern template class QuantizedFastContainer<int64_t, uint32_t>;
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Bits of a double in the order of the values: the sign bit is set for positive values
+// and all bits are flipped for negative ones. -0 is mapped to +0 to keep them equal
+inline uint64_t orderedBits(double value)
+{
+    value += 0.;
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint64_t sign = uint64_t(1) << 63;
+    return bits & sign ? ~bits : bits | sign;
+}
+
+inline uint64_t orderedBits(float value)
+{
+    value += 0.f;
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = uint32_t(1) << 31;
+    return bits & sign ? ~bits : bits | sign;
+}
+
+// Integers are sign extended and the sign bit is flipped, so negative values come first
+template <typename T>
+inline std::enable_if_t<std::is_integral_v<T>, uint64_t> orderedBits(T value)
+{
+    if constexpr (std::is_signed_v<T>)
+        return uint64_t(int64_t(value)) ^ (uint64_t(1) << 63);
+    else
+        return uint64_t(value);
+}
+
+// Runs fn(begin, end, thread) over nThreads contiguous chunks of [0, n).
+// The chunks only depend on n and nThreads. With a pool its threads take the chunks, so repeated calls
+// neither start threads nor allocate, otherwise nThreads - 1 threads are started for the call
+template <typename Fn>
+void parallelFor(int nThreads, size_t n, Fn fn, ThreadPool* pool = nullptr)
+{
+    const size_t chunk = (n + nThreads - 1) / nThreads;
+    if (pool)
+    {
+        // the job only holds a reference, so std::function keeps it without allocating
+        auto run = [&](size_t begin, size_t end)
+        {
+            for (size_t thread = begin; thread < end; ++thread)
+                fn(std::min(n, thread * chunk), std::min(n, (thread + 1) * chunk), int(thread));
+        };
+        pool->forEachChunk(nThreads, 1, [&run](size_t begin, size_t end){ run(begin, end); });
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    for (int thread = 1; thread < nThreads; ++thread)
+    {
+        const size_t begin = std::min(n, thread * chunk);
+        const size_t end = std::min(n, begin + chunk);
+        threads.emplace_back(fn, begin, end, thread);
+    }
+    fn(0, std::min(n, chunk), 0);
+
+    for (auto& thread: threads)
+        thread.join();
+}
+
+// Number of threads worth to start for n elements
+inline int getNWorkers(int maxThreads, size_t n)
+{
+    static const size_t minChunk = 1 << 16;
+    const size_t nThreads = std::min<size_t>(maxThreads, n / minChunk);
+    return nThreads > 1 ? nThreads : 1;
+}
+
+// Stable LSD radix sort by the 64 bit key(elem), 8 bits per pass.
+// Every pass counts the digits per thread, the prefix sums over (digit, thread) give every thread
+// its own output offsets, so the scatter needs no synchronisation. Passes where all elements
+// share the digit are skipped. buffer and histograms are scratch, callers sorting repeatedly keep
+// them and a pool to reuse their capacity and threads. data and buffer may be vectors of different allocators
+template <typename Data, typename Buffer, typename Histograms, typename KeyFn>
+void radixSort(Data& data, Buffer& buffer, Histograms& histograms, KeyFn key, int maxThreads, ThreadPool* pool = nullptr)
+{
+    const size_t n = data.size();
+    const int nThreads = getNWorkers(maxThreads, n);
+    buffer.resize(n);
+    histograms.resize(nThreads);
+
+    auto* from = data.data();
+    auto* to = buffer.data();
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        parallelFor(nThreads, n, [&](size_t begin, size_t end, int thread)
+        {
+            auto& histogram = histograms[thread];
+            histogram.fill(0);
+            for (size_t idx = begin; idx < end; ++idx)
+                ++histogram[(key(from[idx]) >> shift) & 0xFF];
+        }, pool);
+
+        size_t offset = 0;
+        bool trivial = false;
+        for (int digit = 0; digit < 256; ++digit)
+        {
+            size_t count = 0;
+            for (int thread = 0; thread < nThreads; ++thread)
+            {
+                auto& histogram = histograms[thread];
+                const size_t tmp = histogram[digit];
+                histogram[digit] = offset + count;
+                count += tmp;
+            }
+            trivial = trivial || count == n;
+            offset += count;
+        }
+        if (trivial)
+            continue;
+
+        parallelFor(nThreads, n, [&](size_t begin, size_t end, int thread)
+        {
+            auto& histogram = histograms[thread];
+            for (size_t idx = begin; idx < end; ++idx)
+                to[histogram[(key(from[idx]) >> shift) & 0xFF]++] = from[idx];
+        }, pool);
+        std::swap(from, to);
+    }
+
+    // after an odd number of scatters the result is in buffer
+    if (from != data.data())
+    {
+        if constexpr (std::is_same_v<Data, Buffer>)
+            data.swap(buffer);
+        else
+            std::copy(from, from + n, data.begin());
+    }
+}
+
+template <typename Data, typename Buffer, typename KeyFn>
+void radixSort(Data& data, Buffer& buffer, KeyFn key, int maxThreads)
+{
+    std::vector<std::array<size_t, 256>> histograms;
+    radixSort(data, buffer, histograms, key, maxThreads);
+}
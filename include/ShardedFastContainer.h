@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <sched.h>
+
+#include "FastContainer.h"
+#include "RadixSort.h"
+#include "ThreadPool.h"
+
+// FastContainer split by value into shards for very large inputs, e.g. one shard per core.
+// The bounds of the shards are quantiles of the input, so every shard holds about the same number of
+// points, and every shard has its own cells and its own _deltaZ. set() builds the shards in parallel:
+// the thread building a shard is pinned to a cpu and allocates all memory of the shard, so on NUMA
+// machines the pages of the shard stay on the node of that cpu (first touch).
+// A query searches the shard bounds, a few cache lines, and then one shard. The nearest value of a
+// query next to a shard bound may be in a neighbour shard: as for the cells, every shard keeps its first
+// and last value and the nearest filled shards on both sides.
+template <typename Key, typename Id = int, int BatchSize = 5>
+class ShardedFastContainer
+{
+  static_assert(std::is_arithmetic_v<Key> && !std::is_same_v<Key, bool>, "Key must be an arithmetic type");
+public:
+  using Container = FastContainer<Key, Id, BatchSize>;
+  using const_iterator = typename Container::const_iterator;
+  using Range = typename Container::Range;
+
+private:
+  static const size_t _bulkChunk = 1 << 12; // queries per chunk of getClosestIds
+  static const int _samplesPerShard = 1 << 10; // input values sampled for the bounds of a shard
+
+  struct Shard
+  {
+    Key first = Key(); // first and last value of a filled shard
+    Key last = Key();
+    Range firstIds;
+    Range lastIds;
+    int lNearest = -1; // nearest filled shards, -1 if none
+    int rNearest = -1;
+  };
+
+  // Runs the calling thread on one of its allowed cpus while it lives
+  class CpuPin
+  {
+  private:
+    cpu_set_t _saved;
+    bool _pinned = false;
+  public:
+    explicit CpuPin(int idx);
+    ~CpuPin();
+  };
+
+  Key _lowerBound;
+  Key _upperBound;
+  Bucketing _bucketing = Bucketing::Uniform;
+  int _maxShards;
+  int _nThreads = std::max<int>(std::thread::hardware_concurrency(), 1); // used by set()
+  std::vector<Key> _bounds; // shard s holds [_bounds[s], _bounds[s + 1]), the last one includes _upperBound
+  std::vector<Container> _containers;
+  std::vector<Shard> _shards;
+
+  void setBounds(const std::vector<std::pair<Id, Key>>& input);
+public:
+  // maxShards: shards for large inputs, small ones get fewer of at least 1 << 16 points
+  ShardedFastContainer(Key lowerBound, Key upperBound, int maxShards = std::thread::hardware_concurrency(), Bucketing bucketing = Bucketing::Uniform);
+  // the shards keep iterators into the ids of their containers: a move keeps the containers in place, a copy would not
+  ShardedFastContainer(const ShardedFastContainer&) = delete;
+  ShardedFastContainer& operator=(const ShardedFastContainer&) = delete;
+  ShardedFastContainer(ShardedFastContainer&&) = default;
+  ShardedFastContainer& operator=(ShardedFastContainer&&) = default;
+  ~ShardedFastContainer() = default;
+
+  void set(const std::vector<std::pair<Id, Key>>& input);
+  // z outside of the bounds takes the first or the last shard
+  int getShardOf(Key z) const;
+  // ids of the nearest value, an empty range if there are no values. Of two values at the same distance
+  // either one may be taken, as in FastContainer where it depends on the cells
+  const Range getClosestId(Key z) const;
+  void getClosestIds(const std::vector<Key>& queries, std::vector<Id>& out, ThreadPool& pool) const;
+  // ids in [lowerZ, upperZ] in the order of their values. out is reused
+  void getIdsInRange(Key lowerZ, Key upperZ, std::vector<Id>& out) const;
+  size_t countInRange(Key lowerZ, Key upperZ) const;
+  bool isEmpty() const;
+  inline int getNShards() const {return _containers.size();};
+  inline const Container& getShard(int shard) const {return _containers[shard];};
+  size_t getMemoryUsage() const;
+  inline int getNThreads() const {return _nThreads;};
+  inline void setNThreads(int nThreads) {_nThreads = std::max(nThreads, 1);};
+};
+
+template <typename Key, typename Id, int BatchSize>
+ShardedFastContainer<Key, Id, BatchSize>::ShardedFastContainer(Key lowerBound, Key upperBound, int maxShards, Bucketing bucketing):
+    _lowerBound(lowerBound),
+    _upperBound(upperBound),
+    _bucketing(bucketing),
+    _maxShards(std::max(maxShards, 1)),
+    _bounds({lowerBound, upperBound})
+{
+    // check bounds
+    if (upperBound <= lowerBound)
+        throw std::invalid_argument("Incorrect upper and lower bounds");
+
+    _containers.emplace_back(lowerBound, upperBound, bucketing);
+    _shards.resize(1);
+}
+
+template <typename Key, typename Id, int BatchSize>
+ShardedFastContainer<Key, Id, BatchSize>::CpuPin::CpuPin(int idx)
+{
+    // idx-th of the allowed cpus, so the shards spread over the cpus and their nodes
+    if (sched_getaffinity(0, sizeof(_saved), &_saved) != 0 || CPU_COUNT(&_saved) < 2)
+        return;
+
+    int n = idx % CPU_COUNT(&_saved);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &_saved) || n-- > 0)
+            continue;
+
+        cpu_set_t pinned;
+        CPU_ZERO(&pinned);
+        CPU_SET(cpu, &pinned);
+        _pinned = sched_setaffinity(0, sizeof(pinned), &pinned) == 0;
+        return;
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+ShardedFastContainer<Key, Id, BatchSize>::CpuPin::~CpuPin()
+{
+    if (_pinned)
+        sched_setaffinity(0, sizeof(_saved), &_saved);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void ShardedFastContainer<Key, Id, BatchSize>::setBounds(const std::vector<std::pair<Id, Key>>& input)
+{
+    // quantiles of an evenly strided sample, equal quantiles give a single shard
+    const int nShards = getNWorkers(_maxShards, input.size());
+    const size_t nSamples = std::min<size_t>(input.size(), size_t(nShards) * _samplesPerShard);
+    std::vector<Key> samples;
+    samples.reserve(nSamples);
+    for (size_t idx = 0; idx < nSamples; ++idx)
+        samples.push_back(input[idx * (input.size() / nSamples)].second);
+    std::sort(samples.begin(), samples.end());
+
+    _bounds.assign(1, _lowerBound);
+    for (int shard = 1; shard < nShards; ++shard)
+    {
+        const Key bound = samples[shard * nSamples / nShards];
+        if (bound > _bounds.back() && bound < _upperBound)
+            _bounds.push_back(bound);
+    }
+    _bounds.push_back(_upperBound);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void ShardedFastContainer<Key, Id, BatchSize>::set(const std::vector<std::pair<Id, Key>>& input)
+{
+    // check bounds against input
+    for (const auto& elem: input)
+    {
+        if (elem.second < _lowerBound || elem.second > _upperBound)
+            throw std::invalid_argument("Input is out of range [lower, upper]");
+    }
+
+    _containers.clear();
+    _shards.clear();
+    _bounds.assign({_lowerBound, _upperBound});
+    if (!input.empty())
+        setBounds(input);
+    const int nShards = _bounds.size() - 1;
+
+    // Points of every shard in input order, counted and scattered per thread as in radixSort:
+    // the prefix sums over (shard, thread) give every thread its own output positions
+    const int nThreads = getNWorkers(_nThreads, input.size());
+    std::vector<std::vector<size_t>> counts(nThreads, std::vector<size_t>(nShards, 0));
+    parallelFor(nThreads, input.size(), [&](size_t begin, size_t end, int thread)
+    {
+        for (size_t idx = begin; idx < end; ++idx)
+            ++counts[thread][getShardOf(input[idx].second)];
+    });
+
+    std::vector<size_t> offsets(nShards + 1, 0);
+    for (int shard = 0; shard < nShards; ++shard)
+    {
+        offsets[shard + 1] = offsets[shard];
+        for (int thread = 0; thread < nThreads; ++thread)
+        {
+            const size_t count = counts[thread][shard];
+            counts[thread][shard] = offsets[shard + 1];
+            offsets[shard + 1] += count;
+        }
+    }
+
+    std::vector<std::pair<Id, Key>> scattered(input.size());
+    parallelFor(nThreads, input.size(), [&](size_t begin, size_t end, int thread)
+    {
+        auto& next = counts[thread];
+        for (size_t idx = begin; idx < end; ++idx)
+            scattered[next[getShardOf(input[idx].second)]++] = input[idx];
+    });
+
+    // One thread per group of shards, it copies and builds them on its cpu. Threads started by a pinned
+    // thread inherit its cpu, so every shard is built by its builder alone: the builders are the parallelism
+    for (int shard = 0; shard < nShards; ++shard)
+    {
+        _containers.emplace_back(_bounds[shard], _bounds[shard + 1], _bucketing);
+        _containers.back().setNThreads(1);
+    }
+    _shards.resize(nShards);
+
+    const int nBuilders = std::min(_nThreads, nShards);
+    std::vector<std::exception_ptr> errors(nBuilders);
+    parallelFor(nBuilders, nShards, [&](size_t begin, size_t end, int thread)
+    {
+        try
+        {
+            CpuPin pin(thread);
+            for (size_t shard = begin; shard < end; ++shard)
+            {
+                // the shard sorts its copy in place
+                std::vector<std::pair<Id, Key>> points(scattered.begin() + offsets[shard], scattered.begin() + offsets[shard + 1]);
+                _containers[shard].set(std::move(points));
+                if (points.empty())
+                    continue;
+
+                Shard& s = _shards[shard];
+                s.first = points.front().second;
+                s.last = points.back().second;
+                s.firstIds = _containers[shard].getClosestId(s.first);
+                s.lastIds = _containers[shard].getClosestId(s.last);
+            }
+        }
+        catch (...)
+        {
+            errors[thread] = std::current_exception();
+        }
+    });
+
+    for (const auto& error: errors)
+    {
+        if (error)
+        {
+            _containers.clear();
+            _shards.clear();
+            _bounds.assign({_lowerBound, _upperBound});
+            _containers.emplace_back(_lowerBound, _upperBound, _bucketing);
+            _shards.resize(1);
+            std::rethrow_exception(error);
+        }
+    }
+
+    // links to the nearest filled shards
+    int lNearest = -1;
+    for (int shard = 0; shard < nShards; ++shard)
+    {
+        _shards[shard].lNearest = lNearest;
+        if (!_containers[shard].isEmpty())
+            lNearest = shard;
+    }
+    int rNearest = -1;
+    for (int shard = nShards - 1; shard >= 0; --shard)
+    {
+        _shards[shard].rNearest = rNearest;
+        if (!_containers[shard].isEmpty())
+            rNearest = shard;
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+int ShardedFastContainer<Key, Id, BatchSize>::getShardOf(Key z) const
+{
+    return std::upper_bound(_bounds.begin() + 1, _bounds.end() - 1, z) - (_bounds.begin() + 1);
+}
+
+template <typename Key, typename Id, int BatchSize>
+const typename ShardedFastContainer<Key, Id, BatchSize>::Range ShardedFastContainer<Key, Id, BatchSize>::getClosestId(Key z) const
+{
+    // the nearest value is in the shard of z or it is the last value of the left or the first value
+    // of the right filled shard
+    const int shard = getShardOf(z);
+    const Shard& s = _shards[shard];
+    const Shard* left = s.lNearest > -1 ? &_shards[s.lNearest] : nullptr;
+    const Shard* right = s.rNearest > -1 ? &_shards[s.rNearest] : nullptr;
+
+    if (_containers[shard].isEmpty())
+    {
+        if (left && right)
+            return getDistance(z, left->last) <= getDistance(right->first, z) ? left->lastIds : right->firstIds;
+        if (left)
+            return left->lastIds;
+        if (right)
+            return right->firstIds;
+        return Range();
+    }
+
+    if (z < s.first)
+        return left && getDistance(z, left->last) <= getDistance(s.first, z) ? left->lastIds : s.firstIds;
+    if (z > s.last)
+        return right && getDistance(right->first, z) < getDistance(z, s.last) ? right->firstIds : s.lastIds;
+    return _containers[shard].getClosestId(z);
+}
+
+template <typename Key, typename Id, int BatchSize>
+void ShardedFastContainer<Key, Id, BatchSize>::getClosestIds(const std::vector<Key>& queries, std::vector<Id>& out, ThreadPool& pool) const
+{
+    if (isEmpty())
+        throw std::logic_error("Container is empty");
+
+    out.resize(queries.size());
+    pool.forEachChunk(queries.size(), _bulkChunk, [&](size_t begin, size_t end)
+    {
+        for (size_t idx = begin; idx < end; ++idx)
+            out[idx] = *getClosestId(queries[idx]).first;
+    });
+}
+
+template <typename Key, typename Id, int BatchSize>
+void ShardedFastContainer<Key, Id, BatchSize>::getIdsInRange(Key lowerZ, Key upperZ, std::vector<Id>& out) const
+{
+    out.clear();
+    if (upperZ < lowerZ)
+        return;
+
+    for (int shard = getShardOf(lowerZ); shard <= getShardOf(upperZ); ++shard)
+    {
+        if (_containers[shard].isEmpty())
+            continue;
+
+        const auto [first, last] = _containers[shard].getIdsInRange(lowerZ, upperZ);
+        out.insert(out.end(), first, last);
+    }
+}
+
+template <typename Key, typename Id, int BatchSize>
+size_t ShardedFastContainer<Key, Id, BatchSize>::countInRange(Key lowerZ, Key upperZ) const
+{
+    if (upperZ < lowerZ)
+        return 0;
+
+    size_t count = 0;
+    for (int shard = getShardOf(lowerZ); shard <= getShardOf(upperZ); ++shard)
+        count += _containers[shard].countInRange(lowerZ, upperZ);
+    return count;
+}
+
+template <typename Key, typename Id, int BatchSize>
+bool ShardedFastContainer<Key, Id, BatchSize>::isEmpty() const
+{
+    return std::all_of(_containers.begin(), _containers.end(), [](const Container& container){ return container.isEmpty(); });
+}
+
+template <typename Key, typename Id, int BatchSize>
+size_t ShardedFastContainer<Key, Id, BatchSize>::getMemoryUsage() const
+{
+    size_t usage = sizeof(*this) + _bounds.capacity() * sizeof(Key) + _shards.capacity() * sizeof(Shard);
+    for (const auto& container: _containers)
+        usage += container.getMemoryUsage();
+    return usage;
+}
+
+// common configurations are compiled once in ShardedFastContainer.cxx
+extern template class ShardedFastContainer<double>;
+extern template class ShardedFastContainer<float, uint32_t>;
+extern template class ShardedFastContainer<int64_t, uint32_t>;
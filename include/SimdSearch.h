@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FASTCONTAINER_X86 1
+#endif
+
+// Search of a sorted cell: the rank of z, the number of values below z, is a count of a vector compare.
+// The nearest value is one of the two values around the rank, the range bounds are ranks themselves.
+// The kernels are compiled for their instruction set and picked at runtime, so one binary runs everywhere
+enum class SimdLevel
+{
+  Scalar,
+  AVX2,   // 256 bit compares
+  AVX512  // 512 bit masked compares
+};
+
+inline SimdLevel getSupportedSimdLevel()
+{
+#ifdef FASTCONTAINER_X86
+    static const SimdLevel level = __builtin_cpu_supports("avx512f") ? SimdLevel::AVX512 :
+        (__builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : SimdLevel::Scalar);
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+inline std::atomic<SimdLevel>& getSimdLevelRef()
+{
+    static std::atomic<SimdLevel> level{getSupportedSimdLevel()};
+    return level;
+}
+
+inline SimdLevel getSimdLevel() {return getSimdLevelRef().load(std::memory_order_relaxed);}
+
+// Kernels used by all containers from now on, e.g. to compare them. Levels above the supported one are lowered,
+// the level set is returned
+inline SimdLevel setSimdLevel(SimdLevel level)
+{
+    level = std::min(level, getSupportedSimdLevel());
+    getSimdLevelRef().store(level, std::memory_order_relaxed);
+    return level;
+}
+
+// Key types with vector kernels: floating point and 32 or 64 bit integers
+template <typename T>
+inline constexpr bool hasSimdRank = std::is_same_v<T, double> || std::is_same_v<T, float> ||
+    (std::is_integral_v<T> && (sizeof(T) == 4 || sizeof(T) == 8));
+
+// values compared by one instruction at the current level
+template <typename T>
+inline int getSimdLanes()
+{
+    if constexpr (hasSimdRank<T>)
+    {
+        switch (getSimdLevel())
+        {
+        case SimdLevel::AVX512:
+            return 64 / sizeof(T);
+        case SimdLevel::AVX2:
+            return 32 / sizeof(T);
+        default:
+            break;
+        }
+    }
+    return 1;
+}
+
+// Number of the first size of the n values below z, or not above z for OrEqual. Values from size on are ignored.
+// Branch free: the loop runs over all n slots
+template <bool OrEqual, typename T>
+inline int countBelowScalar(const T* values, int n, int size, T z)
+{
+    int count = 0;
+    for (int idx = 0; idx < n; ++idx)
+        count += int(idx < size) & int(OrEqual ? values[idx] <= z : values[idx] < z);
+    return count;
+}
+
+#ifdef FASTCONTAINER_X86
+// valid lanes of a vector starting at slot idx, as a bit mask
+inline uint32_t getLaneMask(int idx, int size, int lanes)
+{
+    const int valid = std::clamp(size - idx, 0, lanes);
+    return valid == 32 ? ~uint32_t(0) : (uint32_t(1) << valid) - 1;
+}
+
+// Masked loads: the lanes from size on are not read, so a cell is never read past its values
+template <bool OrEqual, typename T>
+__attribute__((target("avx512f"))) int countBelowAVX512(const T* values, int n, int size, T z)
+{
+    constexpr int lanes = 64 / sizeof(T);
+    int count = 0;
+    for (int idx = 0; idx < n; idx += lanes)
+    {
+        const uint32_t valid = getLaneMask(idx, size, lanes);
+        uint32_t below = 0;
+        if constexpr (std::is_same_v<T, double>)
+        {
+            const __m512d v = _mm512_maskz_loadu_pd(valid, values + idx);
+            below = _mm512_mask_cmp_pd_mask(valid, v, _mm512_set1_pd(z), OrEqual ? _CMP_LE_OQ : _CMP_LT_OQ);
+        }
+        else if constexpr (std::is_same_v<T, float>)
+        {
+            const __m512 v = _mm512_maskz_loadu_ps(valid, values + idx);
+            below = _mm512_mask_cmp_ps_mask(valid, v, _mm512_set1_ps(z), OrEqual ? _CMP_LE_OQ : _CMP_LT_OQ);
+        }
+        else if constexpr (sizeof(T) == 8)
+        {
+            const __m512i v = _mm512_maskz_loadu_epi64(valid, values + idx);
+            const __m512i vz = _mm512_set1_epi64(int64_t(z));
+            if constexpr (std::is_signed_v<T>)
+                below = _mm512_mask_cmp_epi64_mask(valid, v, vz, OrEqual ? _MM_CMPINT_LE : _MM_CMPINT_LT);
+            else
+                below = _mm512_mask_cmp_epu64_mask(valid, v, vz, OrEqual ? _MM_CMPINT_LE : _MM_CMPINT_LT);
+        }
+        else
+        {
+            const __m512i v = _mm512_maskz_loadu_epi32(valid, values + idx);
+            const __m512i vz = _mm512_set1_epi32(int32_t(z));
+            if constexpr (std::is_signed_v<T>)
+                below = _mm512_mask_cmp_epi32_mask(valid, v, vz, OrEqual ? _MM_CMPINT_LE : _MM_CMPINT_LT);
+            else
+                below = _mm512_mask_cmp_epu32_mask(valid, v, vz, OrEqual ? _MM_CMPINT_LE : _MM_CMPINT_LT);
+        }
+        count += __builtin_popcount(below);
+    }
+    return count;
+}
+
+// AVX2 has no masked compares: the load mask zeroes the lanes from size on and the compare bits are masked.
+// Unsigned integers are compared as signed ones with the sign bit flipped
+template <bool OrEqual, typename T>
+__attribute__((target("avx2"))) int countBelowAVX2(const T* values, int n, int size, T z)
+{
+    constexpr int lanes = 32 / sizeof(T);
+    int count = 0;
+    for (int idx = 0; idx < n; idx += lanes)
+    {
+        const uint32_t valid = getLaneMask(idx, size, lanes);
+        uint32_t below = 0;
+        if constexpr (sizeof(T) == 8)
+        {
+            const __m256i load = _mm256_cmpgt_epi64(_mm256_set1_epi64x(size - idx), _mm256_setr_epi64x(0, 1, 2, 3));
+            if constexpr (std::is_same_v<T, double>)
+            {
+                const __m256d v = _mm256_maskload_pd(values + idx, load);
+                below = _mm256_movemask_pd(_mm256_cmp_pd(v, _mm256_set1_pd(z), OrEqual ? _CMP_LE_OQ : _CMP_LT_OQ));
+            }
+            else
+            {
+                const __m256i flip = _mm256_set1_epi64x(std::is_signed_v<T> ? 0 : INT64_MIN);
+                const __m256i v = _mm256_xor_si256(_mm256_maskload_epi64(reinterpret_cast<const long long*>(values + idx), load), flip);
+                const __m256i vz = _mm256_xor_si256(_mm256_set1_epi64x(int64_t(z)), flip);
+                // v <= z is !(v > z)
+                const __m256i cmp = OrEqual ? _mm256_andnot_si256(_mm256_cmpgt_epi64(v, vz), _mm256_set1_epi64x(-1)) : _mm256_cmpgt_epi64(vz, v);
+                below = _mm256_movemask_pd(_mm256_castsi256_pd(cmp));
+            }
+        }
+        else
+        {
+            const __m256i load = _mm256_cmpgt_epi32(_mm256_set1_epi32(size - idx), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            if constexpr (std::is_same_v<T, float>)
+            {
+                const __m256 v = _mm256_maskload_ps(values + idx, load);
+                below = _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_set1_ps(z), OrEqual ? _CMP_LE_OQ : _CMP_LT_OQ));
+            }
+            else
+            {
+                const __m256i flip = _mm256_set1_epi32(std::is_signed_v<T> ? 0 : INT32_MIN);
+                const __m256i v = _mm256_xor_si256(_mm256_maskload_epi32(reinterpret_cast<const int*>(values + idx), load), flip);
+                const __m256i vz = _mm256_xor_si256(_mm256_set1_epi32(int32_t(z)), flip);
+                const __m256i cmp = OrEqual ? _mm256_andnot_si256(_mm256_cmpgt_epi32(v, vz), _mm256_set1_epi32(-1)) : _mm256_cmpgt_epi32(vz, v);
+                below = _mm256_movemask_ps(_mm256_castsi256_ps(cmp));
+            }
+        }
+        count += __builtin_popcount(below & valid);
+    }
+    return count;
+}
+#endif
+
+// Rank of z among the first size of the n sorted values: the values below z, or not above z for OrEqual.
+// Cells with fewer slots than a vector are compared by one instruction
+template <bool OrEqual, typename T>
+inline int countBelow(const T* values, int n, int size, T z)
+{
+#ifdef FASTCONTAINER_X86
+    if constexpr (hasSimdRank<T>)
+    {
+        switch (getSimdLevel())
+        {
+        case SimdLevel::AVX512:
+            return countBelowAVX512<OrEqual>(values, n, size, z);
+        case SimdLevel::AVX2:
+            return countBelowAVX2<OrEqual>(values, n, size, z);
+        default:
+            break;
+        }
+    }
+#endif
+    return countBelowScalar<OrEqual>(values, n, size, z);
+}
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "FastContainer.h"
+
+// Sliding window over time ordered values, e.g. timestamps arriving at the tail and expiring at the head.
+// Points live in a ring buffer in arrival order, so the values are sorted by their sequence number.
+// Cells of fixed width form a second ring: cell c covers [origin + c * width, origin + (c + 1) * width)
+// and stores the sequence range of its points. An empty cell stores the position of the next point,
+// so the cells need no links to their filled neighbours. Both rings grow by doubling.
+// A gap of more than _maxGap empty cells is not opened: the cells after it start a new segment of
+// the ring, and the values falling in the gap are answered by the first point of that segment.
+template <typename Key, typename Id = int>
+class StreamingFastContainer
+{
+  static_assert(std::is_arithmetic_v<Key> && !std::is_same_v<Key, bool>, "Key must be an arithmetic type");
+public:
+  // random access iterator over the ids of a sequence range, it wraps around the ring
+  class const_iterator
+  {
+  private:
+    const Id* _data = nullptr;
+    uint64_t _mask = 0;
+    uint64_t _seq = 0;
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Id;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Id*;
+    using reference = const Id&;
+
+    const_iterator() = default;
+    const_iterator(const Id* data, uint64_t mask, uint64_t seq): _data(data), _mask(mask), _seq(seq) {};
+
+    inline reference operator*() const {return _data[_seq & _mask];};
+    inline pointer operator->() const {return &_data[_seq & _mask];};
+    inline reference operator[](difference_type n) const {return _data[(_seq + n) & _mask];};
+    inline const_iterator& operator++() {++_seq; return *this;};
+    inline const_iterator operator++(int) {auto tmp = *this; ++_seq; return tmp;};
+    inline const_iterator& operator--() {--_seq; return *this;};
+    inline const_iterator operator--(int) {auto tmp = *this; --_seq; return tmp;};
+    inline const_iterator& operator+=(difference_type n) {_seq += n; return *this;};
+    inline const_iterator& operator-=(difference_type n) {_seq -= n; return *this;};
+    inline const_iterator operator+(difference_type n) const {return const_iterator(_data, _mask, _seq + n);};
+    inline const_iterator operator-(difference_type n) const {return const_iterator(_data, _mask, _seq - n);};
+    inline difference_type operator-(const const_iterator& other) const {return difference_type(_seq - other._seq);};
+    inline bool operator==(const const_iterator& other) const {return _seq == other._seq;};
+    inline bool operator!=(const const_iterator& other) const {return _seq != other._seq;};
+    inline bool operator<(const const_iterator& other) const {return _seq < other._seq;};
+    inline bool operator>(const const_iterator& other) const {return _seq > other._seq;};
+    inline bool operator<=(const const_iterator& other) const {return _seq <= other._seq;};
+    inline bool operator>=(const const_iterator& other) const {return _seq >= other._seq;};
+  };
+  using Range = std::pair<const_iterator, const_iterator>;
+
+private:
+  static const int64_t _maxGap = 64; // empty cells opened between two points, more start a new segment
+
+  struct Cell
+  {
+    uint64_t first = 0; // sequence range of the points of the cell
+    uint64_t end = 0;
+  };
+  // consecutive cells stored from a slot of the cell ring on
+  struct Segment
+  {
+    int64_t firstCell = 0;
+    int64_t firstSlot = 0;
+  };
+
+  Key _cellWidth;
+  Key _origin = Key();   // value of the first point ever appended
+  bool _started = false;
+
+  // points: sequence numbers [_headSeq, _tailSeq), stored at seq & (capacity - 1)
+  std::vector<Key> _values;
+  std::vector<Id> _ids;
+  uint64_t _headSeq = 0;
+  uint64_t _tailSeq = 0;
+
+  // cells: slots [_headSlot, _tailSlot], stored at slot & (capacity - 1). The segments map the
+  // cell numbers [_headCell, _tailCell] to the slots, the first one holds the head cell
+  std::vector<Cell> _cells;
+  std::deque<Segment> _segments;
+  int64_t _headSlot = 0;
+  int64_t _tailSlot = -1;
+  int64_t _headCell = 0;
+  int64_t _tailCell = -1;
+
+  int64_t getCellNumber(Key z) const;
+  inline const Key& getValue(uint64_t seq) const {return _values[seq & (_values.size() - 1)];};
+  inline const Cell& getSlot(int64_t slot) const {return _cells[slot & (_cells.size() - 1)];};
+  inline Cell& getSlot(int64_t slot) {return _cells[slot & (_cells.size() - 1)];};
+  // cell of a value between the front and the back, an empty one at the next point inside a gap
+  Cell getCell(Key z) const;
+  void growPoints();
+  void growCells(size_t nCells);
+  // first sequence number with a value >= z (lower) or > z (upper)
+  uint64_t lowerBound(Key z) const;
+  uint64_t upperBound(Key z) const;
+  inline const_iterator getIterator(uint64_t seq) const {return const_iterator(_ids.data(), _ids.size() - 1, seq);};
+public:
+  explicit StreamingFastContainer(Key cellWidth);
+  ~StreamingFastContainer() = default;
+
+  // t must not be smaller than the last appended value. O(1) amortised, it opens at most _maxGap empty cells
+  void append(Id id, Key t);
+  // drops the points with values < t, returns their number
+  size_t expireBefore(Key t);
+  const Range getClosestId(Key z) const;
+  const Range getIdsInRange(Key lowerZ, Key upperZ) const;
+  inline bool isEmpty() const {return _headSeq == _tailSeq;};
+  inline size_t getSize() const {return _tailSeq - _headSeq;};
+  // cells stored, the gaps between segments are not counted
+  inline size_t getNCells() const {return isEmpty() ? 0 : _tailSlot - _headSlot + 1;};
+  inline Key getFront() const {return getValue(_headSeq);};
+  inline Key getBack() const {return getValue(_tailSeq - 1);};
+};
+
+template <typename Key, typename Id>
+StreamingFastContainer<Key, Id>::StreamingFastContainer(Key cellWidth):
+    _cellWidth(cellWidth),
+    _values(16),
+    _ids(16),
+    _cells(16)
+{
+    if (!(cellWidth > 0))
+        throw std::invalid_argument("Incorrect cell width");
+}
+
+template <typename Key, typename Id>
+int64_t StreamingFastContainer<Key, Id>::getCellNumber(Key z) const
+{
+    // z is not below the origin here: queries outside of the points are answered by the ends
+    if constexpr (std::is_integral_v<Key>)
+        return getDistance(z, _origin) / Distance<Key>(_cellWidth);
+    else
+        return std::floor((z - _origin) / _cellWidth);
+}
+
+template <typename Key, typename Id>
+typename StreamingFastContainer<Key, Id>::Cell StreamingFastContainer<Key, Id>::getCell(Key z) const
+{
+    // last segment starting at or before the cell of z, usually the only one
+    const int64_t cell = getCellNumber(z);
+    auto segment = std::upper_bound(_segments.begin(), _segments.end(), cell,
+                                    [](int64_t number, const Segment& other) {return number < other.firstCell;});
+    --segment;
+    const int64_t slot = segment->firstSlot + (cell - segment->firstCell);
+    const auto next = segment + 1;
+    if (next == _segments.end() || slot < next->firstSlot)
+        return getSlot(slot);
+
+    const uint64_t seq = getSlot(next->firstSlot).first;
+    return {seq, seq};
+}
+
+template <typename Key, typename Id>
+void StreamingFastContainer<Key, Id>::growPoints()
+{
+    // the live points keep their sequence numbers, only the mask changes
+    const size_t capacity = _values.size() * 2;
+    std::vector<Key> values(capacity);
+    std::vector<Id> ids(capacity);
+    for (uint64_t seq = _headSeq; seq < _tailSeq; ++seq)
+    {
+        values[seq & (capacity - 1)] = _values[seq & (_values.size() - 1)];
+        ids[seq & (capacity - 1)] = _ids[seq & (_ids.size() - 1)];
+    }
+    _values.swap(values);
+    _ids.swap(ids);
+}
+
+template <typename Key, typename Id>
+void StreamingFastContainer<Key, Id>::growCells(size_t nCells)
+{
+    size_t capacity = _cells.size();
+    while (capacity < nCells)
+        capacity *= 2;
+    if (capacity == _cells.size())
+        return;
+
+    std::vector<Cell> cells(capacity);
+    for (int64_t slot = _headSlot; slot <= _tailSlot; ++slot)
+        cells[slot & (capacity - 1)] = getSlot(slot);
+    _cells.swap(cells);
+}
+
+template <typename Key, typename Id>
+void StreamingFastContainer<Key, Id>::append(Id id, Key t)
+{
+    if (!_started)
+    {
+        _origin = t;
+        _started = true;
+    }
+    else if (!isEmpty() && t < getBack())
+        throw std::invalid_argument("Values must be appended in order");
+    else if (t < _origin)
+        throw std::invalid_argument("Value is before the origin of the window");
+
+    if (getSize() == _values.size())
+        growPoints();
+
+    // open the cells up to the one of t, empty cells point to the position of the new point.
+    // After a longer gap the cell of t starts a new segment
+    const int64_t cell = getCellNumber(t);
+    if (isEmpty())
+    {
+        _segments.assign(1, {cell, 0});
+        _headSlot = 0;
+        _tailSlot = -1;
+        _headCell = cell;
+        _tailCell = cell - 1;
+    }
+    if (cell > _tailCell)
+    {
+        int64_t nOpened = cell - _tailCell;
+        if (nOpened > _maxGap)
+        {
+            _segments.push_back({cell, _tailSlot + 1});
+            nOpened = 1;
+        }
+        growCells(_tailSlot + nOpened - _headSlot + 1);
+        for (int64_t slot = _tailSlot + 1; slot <= _tailSlot + nOpened; ++slot)
+            getSlot(slot) = {_tailSeq, _tailSeq};
+        _tailSlot += nOpened;
+        _tailCell = cell;
+    }
+
+    _values[_tailSeq & (_values.size() - 1)] = t;
+    _ids[_tailSeq & (_ids.size() - 1)] = id;
+    ++_tailSeq;
+    ++getSlot(_tailSlot).end;
+}
+
+template <typename Key, typename Id>
+size_t StreamingFastContainer<Key, Id>::expireBefore(Key t)
+{
+    if (isEmpty() || !(getFront() < t))
+        return 0;
+
+    const uint64_t headSeq = lowerBound(t);
+    const size_t nExpired = headSeq - _headSeq;
+    _headSeq = headSeq;
+    if (isEmpty())
+    {
+        _segments.clear();
+        _headSlot = 0;
+        _tailSlot = -1;
+        _headCell = 0;
+        _tailCell = -1;
+        return nExpired;
+    }
+
+    // the cell of the new first point becomes the head, it may keep a part of its points.
+    // A point is never in a gap, so the head cell is stored in the first segment left
+    _headCell = getCellNumber(getFront());
+    while (_segments.size() > 1 && _segments[1].firstCell <= _headCell)
+        _segments.pop_front();
+    _headSlot = _segments.front().firstSlot + (_headCell - _segments.front().firstCell);
+    getSlot(_headSlot).first = _headSeq;
+    return nExpired;
+}
+
+template <typename Key, typename Id>
+uint64_t StreamingFastContainer<Key, Id>::lowerBound(Key z) const
+{
+    if (isEmpty() || !(getFront() < z))
+        return _headSeq;
+    if (getBack() < z)
+        return _tailSeq;
+
+    // binary search in the sequence range of the cell of z
+    const Cell cell = getCell(z);
+    uint64_t lo = cell.first;
+    uint64_t hi = cell.end;
+    while (lo < hi)
+    {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (getValue(mid) < z)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+template <typename Key, typename Id>
+uint64_t StreamingFastContainer<Key, Id>::upperBound(Key z) const
+{
+    if (isEmpty() || z < getFront())
+        return _headSeq;
+    if (!(z < getBack()))
+        return _tailSeq;
+
+    const Cell cell = getCell(z);
+    uint64_t lo = cell.first;
+    uint64_t hi = cell.end;
+    while (lo < hi)
+    {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (z < getValue(mid))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+template <typename Key, typename Id>
+const typename StreamingFastContainer<Key, Id>::Range StreamingFastContainer<Key, Id>::getClosestId(Key z) const
+{
+    if (isEmpty())
+        return {getIterator(_tailSeq), getIterator(_tailSeq)};
+
+    // the nearest value is the first one >= z or the one before it
+    uint64_t seq = lowerBound(z);
+    if (seq == _tailSeq || (seq > _headSeq && getDistance(z, getValue(seq - 1)) <= getDistance(getValue(seq), z)))
+        --seq;
+
+    const Key value = getValue(seq);
+    return {getIterator(lowerBound(value)), getIterator(upperBound(value))};
+}
+
+template <typename Key, typename Id>
+const typename StreamingFastContainer<Key, Id>::Range StreamingFastContainer<Key, Id>::getIdsInRange(Key lowerZ, Key upperZ) const
+{
+    if (isEmpty() || upperZ < lowerZ)
+        return {getIterator(_tailSeq), getIterator(_tailSeq)};
+
+    return {getIterator(lowerBound(lowerZ)), getIterator(upperBound(upperZ))};
+}
+
+// common configurations are compiled once in StreamingFastContainer.cxx
+extern template class StreamingFastContainer<double>;
+extern template class StreamingFastContainer<int64_t, uint32_t>;
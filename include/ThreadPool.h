@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Threads started once and reused by every bulk call, e.g. getClosestIds over a static container.
+// A call splits [0, n) into chunks that the workers and the calling thread take from a shared
+// counter: a thread done with its chunk takes the next one, so slow chunks do not hold the others back
+class ThreadPool
+{
+public:
+  using Job = std::function<void(size_t, size_t)>;
+
+private:
+  std::vector<std::thread> _workers;
+  std::mutex _callMutex; // one call at a time
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _done;
+  // the current call, set under _mutex before the workers are woken
+  const Job* _job = nullptr;
+  size_t _n = 0;
+  size_t _chunk = 1;
+  std::atomic<size_t> _next{0};
+  uint64_t _generation = 0;
+  int _nPending = 0; // workers not done with the current call
+  bool _stop = false;
+  std::exception_ptr _error;
+
+  void work();
+  void takeChunks(const Job& job);
+public:
+  // nThreads threads share a call, the calling thread included
+  explicit ThreadPool(int nThreads = std::thread::hardware_concurrency());
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ~ThreadPool();
+
+  // job(begin, end) for every chunk of [0, n) of at most chunk elements, returns when all chunks are done.
+  // The first exception thrown by a job is rethrown here, the chunks not taken yet are skipped.
+  // A job must not call forEachChunk of the same pool
+  void forEachChunk(size_t n, size_t chunk, const Job& job);
+  inline int getNThreads() const {return int(_workers.size()) + 1;};
+};
@@ -0,0 +1,5 @@
+#include "CompactFastContainer.h"
+
+template class CompactFastContainer<double>;
+template class CompactFastContainer<float, uint32_t>;
+template class CompactFastContainer<int64_t, uint32_t>;
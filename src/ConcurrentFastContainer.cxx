@@ -0,0 +1,3 @@
+#include "ConcurrentFastContainer.h"
+
+template class ConcurrentFastContainer<double>;
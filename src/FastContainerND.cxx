@@ -0,0 +1,4 @@
+#include "FastContainerND.h"
+
+template class FastContainerND<2>;
+template class FastContainerND<3>;
@@ -0,0 +1,6 @@
+#include "QuantizedFastContainer.h"
+
+template class QuantizedFastContainer<double>;
+template class QuantizedFastContainer<double, int, 5, uint32_t>;
+template class QuantizedFastContainer<float, uint32_t>;
+template class QuantizedFastContainer<int64_t, uint32_t>;
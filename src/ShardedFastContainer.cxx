@@ -0,0 +1,5 @@
+#include "ShardedFastContainer.h"
+
+template class ShardedFastContainer<double>;
+template class ShardedFastContainer<float, uint32_t>;
+template class ShardedFastContainer<int64_t, uint32_t>;
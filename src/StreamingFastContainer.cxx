@@ -0,0 +1,4 @@
+#include "StreamingFastContainer.h"
+
+template class StreamingFastContainer<double>;
+template class StreamingFastContainer<int64_t, uint32_t>;
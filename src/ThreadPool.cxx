@@ -0,0 +1,94 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int nThreads)
+{
+    const int nWorkers = std::max(nThreads, 1) - 1;
+    _workers.reserve(nWorkers);
+    for (int worker = 0; worker < nWorkers; ++worker)
+        _workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& worker: _workers)
+        worker.join();
+}
+
+void ThreadPool::forEachChunk(size_t n, size_t chunk, const Job& job)
+{
+    chunk = std::max<size_t>(chunk, 1);
+    if (_workers.empty() || n <= chunk)
+    {
+        for (size_t begin = 0; begin < n; begin += chunk)
+            job(begin, std::min(n, begin + chunk));
+        return;
+    }
+
+    std::lock_guard<std::mutex> call(_callMutex);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _job = &job;
+        _n = n;
+        _chunk = chunk;
+        _next.store(0);
+        _nPending = _workers.size();
+        ++_generation;
+    }
+    _wake.notify_all();
+    takeChunks(job);
+
+    // every worker joins every call, so none of them can see the job after it is gone
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]{ return _nPending == 0; });
+    _job = nullptr;
+    if (_error)
+        std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+void ThreadPool::work()
+{
+    uint64_t generation = 0;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [&]{ return _stop || _generation != generation; });
+        if (_stop)
+            return;
+        generation = _generation;
+        const Job& job = *_job;
+        lock.unlock();
+
+        takeChunks(job);
+
+        lock.lock();
+        if (--_nPending == 0)
+            _done.notify_one();
+    }
+}
+
+void ThreadPool::takeChunks(const Job& job)
+{
+    while (true)
+    {
+        const size_t begin = _next.fetch_add(_chunk);
+        if (begin >= _n)
+            return;
+
+        try
+        {
+            job(begin, std::min(_n, begin + _chunk));
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error)
+                _error = std::current_exception();
+            _next.store(_n);
+        }
+    }
+}
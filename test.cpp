@@ -1,8 +1,20 @@
 #include <random>
 #include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <set>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include "FastContainer.h"
+#include "CompactFastContainer.h"
+#include "FastContainerND.h"
+#include "ConcurrentFastContainer.h"
+#include "StreamingFastContainer.h"
+#include "ShardedFastContainer.h"
+#include "PayloadFastContainer.h"
+#include "QuantizedFastContainer.h"
 
 #include "TAxis.h"
 #include "TGraph.h"
@@ -10,6 +22,57 @@
 #include "TLegend.h"
 #include "TCanvas.h"
 
+// Mismatches found by the checks, any of them fails the run
+int nMismatches = 0;
+
+// stream for the description of a mismatch, which is counted
+std::ostream& mismatch()
+{
+    ++nMismatches;
+    return std::cout;
+}
+
+// random generator of one test
+std::mt19937 makeGenerator()
+{
+    std::random_device rd;
+    return std::mt19937(rd());
+}
+
+// one line of a comparison plot
+TGraph* makeGraph(const char* name, const char* title, Color_t color)
+{
+    TGraph* gr = new TGraph();
+    gr->SetName(name);
+    gr->SetTitle(title);
+    gr->SetLineColor(color);
+    return gr;
+}
+
+// draws the lines of one comparison with their legend and saves it to file
+void savePlot(const char* file, const char* title, const std::vector<TGraph*>& graphs, const char* xTitle, const char* yTitle, bool logX, bool logY)
+{
+    TCanvas* c = new TCanvas(file, "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    if (logX)
+        c->cd()->SetLogx();
+    if (logY)
+        c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph(file, title);
+    for (TGraph* gr: graphs)
+        mg->Add(gr);
+    mg->GetXaxis()->SetTitle(xTitle);
+    mg->GetYaxis()->SetTitle(yTitle);
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    for (TGraph* gr: graphs)
+        legend->AddEntry(gr->GetName());
+    legend->Draw();
+
+    c->SaveAs(file);
+}
+
 void testNearest(bool verbose)
 {
     // create randomer
@@ -111,7 +174,7 @@ void testNearest(bool verbose)
         // TEST NEW SOLUTION
         // fill fast container
         auto startCreation = std::chrono::high_resolution_clock::now();
-        FastContainer fc(-200, 200);
+        FastContainer<double> fc(-200, 200);
         fc.set(vec);
 
         std::vector<int> resF;
@@ -148,13 +211,13 @@ void testNearest(bool verbose)
         // compare values
         if (verbose) std::cout << "Check solutions" << std::endl;
         if (resStd.size() != resF.size())
-            std::cout << "Different sizes" << std::endl;
+            mismatch() << "Different sizes" << std::endl;
         for (int i = 0; i < testN; i++)
         {
             if (resStd.at(i) == resF.at(i))
                 continue;
     
-            std::cout << test.at(i) << " \t" << resStd.at(i) << " " << vec.at(resStd.at(i)).second  << "\t" << test.at(i) - vec.at(resStd.at(i)).second << std::endl;
+            mismatch() << test.at(i) << " \t" << resStd.at(i) << " " << vec.at(resStd.at(i)).second  << "\t" << test.at(i) - vec.at(resStd.at(i)).second << std::endl;
             std::cout << "\t\t" << resF.at(i) << " " << vec.at(resF.at(i)).second << "\t" << test.at(i) - vec.at(resF.at(i)).second << std::endl;
             std::cout << *(fc.getClosestId(test.at(i)).first) << std::endl;
         }
@@ -305,7 +368,7 @@ void testRanges(bool verbose)
         // TEST NEW SOLUTION
         // fill fast container
         auto startCreation = std::chrono::high_resolution_clock::now();
-        FastContainer fc(-200, 200);
+        FastContainer<double> fc(-200, 200);
         fc.set(vec);
 
         std::vector<std::vector<int>> resF;
@@ -345,7 +408,7 @@ void testRanges(bool verbose)
         // compare values
         if (verbose) std::cout << "Check solutions" << std::endl;
         if (resStd.size() != resF.size())
-            std::cout << "Different sizes" << std::endl;
+            mismatch() << "Different sizes" << std::endl;
         for (int i = 0; i < testN-1; i++)
         {
             bool flag1 = true;
@@ -361,10 +424,10 @@ void testRanges(bool verbose)
                 if (!flag1 && !flag2)
                     continue;
                 
-                std::cout << i << "Error: " << flag1 << " " << flag2 << std::endl; 
+                mismatch() << i << "Error: " << flag1 << " " << flag2 << std::endl; 
             }
             else
-                std::cout << i << " Different size: " << resStd.at(i).size() << " " << resF.at(i).size() << std::endl; 
+                mismatch() << i << " Different size: " << resStd.at(i).size() << " " << resF.at(i).size() << std::endl; 
 
             double low = std::min(test[i], test[i+1]);
             double up = std::max(test[i], test[i+1]);
@@ -420,9 +483,2318 @@ void testRanges(bool verbose)
     c->SaveAs("testRanges.png");
 }
 
+void testBatchNearest(bool verbose)
+{
+    // create randomer
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainer");
+    gr_fast->SetLineColor(kBlue);
+    TGraph* gr_fast_batch = new TGraph(); 
+    gr_fast_batch->SetName("gr_fast_batch");
+    gr_fast_batch->SetTitle("FastContainerBatch");
+    gr_fast_batch->SetLineColor(kRed);
+
+    TGraph* gr_dens_fast = new TGraph(); 
+    gr_dens_fast->SetName("gr_dens_fast");
+    gr_dens_fast->SetTitle("FastContainer");
+    gr_dens_fast->SetLineColor(kBlue);
+    TGraph* gr_dens_fast_batch = new TGraph(); 
+    gr_dens_fast_batch->SetName("gr_dens_fast_batch");
+    gr_dens_fast_batch->SetTitle("FastContainerBatch");
+    gr_dens_fast_batch->SetLineColor(kRed);
+
+    // the cells stop fitting into the caches well before the largest input
+    int max_pow = 18;
+    int testN = 1e6;
+
+    for (int ipow = 0; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+        {
+            test.push_back(udist(gen));
+        }
+
+        FastContainer<double> fc(-200, 200);
+        fc.set(vec);
+
+        // TEST SCALAR LOOP
+        std::vector<int> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const auto& elem: test)
+        {
+            int idx = *(fc.getClosestId(elem).first);
+            resF.push_back(idx);
+        }
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Scalar duration: " << durationF.count() << ", muSec" << std::endl;
+
+        // TEST BATCH SOLUTION
+        std::vector<int> resB(testN);
+        auto startB = std::chrono::high_resolution_clock::now();
+        fc.getClosestIds(test, resB);
+        auto stopB = std::chrono::high_resolution_clock::now();
+        auto durationB = std::chrono::duration_cast<std::chrono::microseconds>(stopB - startB);
+        if (verbose) std::cout << "Batch duration: " << durationB.count() << ", muSec" << std::endl;
+
+        gr_fast->AddPoint(N, durationF.count());
+        gr_fast_batch->AddPoint(N, durationB.count());
+        gr_dens_fast->AddPoint(N, durationF.count() * 1./testN);
+        gr_dens_fast_batch->AddPoint(N, durationB.count() * 1./testN);
+
+        if (verbose) std::cout << "Ratio scalar / batch: " << durationF.count() * 1. / durationB.count() << std::endl;
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        if (resF.size() != resB.size())
+            mismatch() << "Different sizes" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            if (resF.at(i) == resB.at(i))
+                continue;
+
+            mismatch() << test.at(i) << " \t" << resF.at(i) << " " << resB.at(i) << std::endl;
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 1800, 900);
+    c->Divide(2);
+
+    c->cd(1)->SetGrid();
+    c->cd(1)->SetLogy();
+    c->cd(1);
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison getNearest, scalar and batch");
+    mg->Add(gr_fast);
+    mg->Add(gr_fast_batch);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_fast");
+    legend->AddEntry("gr_fast_batch");
+    legend->Draw();
+
+    c->cd(2)->SetGrid();
+    c->cd(2);
+    TMultiGraph* mg_dens = new TMultiGraph("mg_dens", "Comparison getNearest, scalar and batch, average time per step");
+    mg_dens->Add(gr_dens_fast);
+    mg_dens->Add(gr_dens_fast_batch);
+    mg_dens->GetXaxis()->SetTitle("Number of values");
+    mg_dens->GetYaxis()->SetTitle("Time / Number of tests, #muS");
+    mg_dens->Draw("AL");
+
+    c->SaveAs("testBatch.png");
+}
+
+void testClustered(bool verbose)
+{
+    // create randomer: sparse uniform background with one tight cluster.
+    // The uniform bucketing would need ~1e8 cells here, so only the quantile and learned ones are tested
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+    std::normal_distribution<> ndist(50.0, 1e-4);
+
+    TGraph* gr_set = new TGraph(); 
+    gr_set->SetName("gr_set");
+    gr_set->SetTitle("Set");
+    gr_set->SetLineColor(kGreen);
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainerQuantile");
+    gr_fast->SetLineColor(kBlue);
+    TGraph* gr_fast_with_init = new TGraph(); 
+    gr_fast_with_init->SetName("gr_fast_with_init");
+    gr_fast_with_init->SetTitle("FastContainerQuantileWithInit");
+    gr_fast_with_init->SetLineColor(kBlack);
+    TGraph* gr_fast_learned = new TGraph(); 
+    gr_fast_learned->SetName("gr_fast_learned");
+    gr_fast_learned->SetTitle("FastContainerLearned");
+    gr_fast_learned->SetLineColor(kMagenta);
+
+    int max_pow = 14;
+    int testN = 1e5;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, i % 2 ? udist(gen) : ndist(gen));
+
+        // generate test numbers, half of them inside of the cluster
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+        {
+            test.push_back(i % 2 ? udist(gen) : ndist(gen));
+        }
+
+        // TEST STD SOLUTION
+        std::vector<int> resStd;
+        resStd.reserve(testN);
+        for (const auto& elem: test)
+        {
+            auto it = std::min_element(vec.begin(), vec.end(), [&elem](const auto& lhs, const auto& rhs){
+                return std::abs(lhs.second-elem) < std::abs(rhs.second-elem);
+            });
+            resStd.push_back(it->first);
+        }
+
+        auto startSet = std::chrono::high_resolution_clock::now();
+        auto comp = [](const std::pair<int, double>& lhs, const std::pair<int, double>& rhs)
+        {
+            return lhs.second < rhs.second;
+        };
+        std::set<std::pair<int, double>, decltype(comp)> tmp_set (vec.begin(), vec.end(), comp);
+
+        std::vector<int> resSet;
+        resSet.reserve(testN);
+        for (const auto& elem: test)
+        {
+            auto it = tmp_set.lower_bound({0, elem});
+            auto pit = it == tmp_set.begin() ? it : std::prev(it);
+            it = it == tmp_set.end() ? pit : it;
+            double res = it->second - elem < elem - pit->second ? it->first : pit->first;
+            resSet.push_back(res);
+        }
+        auto stopSet = std::chrono::high_resolution_clock::now();
+        auto durationSet = std::chrono::duration_cast<std::chrono::microseconds>(stopSet - startSet);
+        if (verbose) std::cout << "Set duration: " << durationSet.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        // fill fast container
+        auto startCreation = std::chrono::high_resolution_clock::now();
+        FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+        fc.set(vec);
+
+        std::vector<int> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const auto& elem: test)
+        {
+            int idx = *(fc.getClosestId(elem).first);
+            resF.push_back(idx);
+        }
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        auto stopCreation = std::chrono::high_resolution_clock::now();
+        auto durationCreation = std::chrono::duration_cast<std::chrono::microseconds>(stopCreation - startCreation);
+        if (verbose){
+            std::cout << "New duration: " << durationF.count() << ", muSec" << std::endl;
+            std::cout << "With creation time: " << durationCreation.count() << ", muSec" << std::endl;
+            std::cout << "Number of cells: " << fc.getNCells() << std::endl;
+        }
+
+        FastContainer<double> fcL(-200, 200, Bucketing::Learned);
+        fcL.set(vec);
+
+        std::vector<int> resL;
+        resL.reserve(testN);
+        auto startL = std::chrono::high_resolution_clock::now();
+        for (const auto& elem: test)
+        {
+            int idx = *(fcL.getClosestId(elem).first);
+            resL.push_back(idx);
+        }
+        auto stopL = std::chrono::high_resolution_clock::now();
+        auto durationL = std::chrono::duration_cast<std::chrono::microseconds>(stopL - startL);
+        if (verbose) std::cout << "Learned duration: " << durationL.count() << ", muSec" << std::endl;
+
+        gr_set->AddPoint(N, durationSet.count());
+        gr_fast->AddPoint(N, durationF.count());
+        gr_fast_with_init->AddPoint(N, durationCreation.count());
+        gr_fast_learned->AddPoint(N, durationL.count());
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        if (resStd.size() != resF.size() || resStd.size() != resL.size())
+            mismatch() << "Different sizes" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            for (const auto& res: {resF, resL})
+            {
+                if (resStd.at(i) == res.at(i) || vec.at(resStd.at(i)).second == vec.at(res.at(i)).second)
+                    continue;
+        
+                mismatch() << test.at(i) << " \t" << resStd.at(i) << " " << vec.at(resStd.at(i)).second  << "\t" << test.at(i) - vec.at(resStd.at(i)).second << std::endl;
+                std::cout << "\t\t" << res.at(i) << " " << vec.at(res.at(i)).second << "\t" << test.at(i) - vec.at(res.at(i)).second << std::endl;
+            }
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison getNearest, clustered input");
+    mg->Add(gr_set);
+    mg->Add(gr_fast);
+    mg->Add(gr_fast_with_init);
+    mg->Add(gr_fast_learned);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_set");
+    legend->AddEntry("gr_fast");
+    legend->AddEntry("gr_fast_with_init");
+    legend->AddEntry("gr_fast_learned");
+    legend->Draw();
+
+    c->SaveAs("testClustered.png");
+}
+
+void testUpdates(bool verbose)
+{
+    // create randomer
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_fast_set = new TGraph(); 
+    gr_fast_set->SetName("gr_fast_set");
+    gr_fast_set->SetTitle("FastContainerSet");
+    gr_fast_set->SetLineColor(kBlack);
+    TGraph* gr_fast_update = new TGraph(); 
+    gr_fast_update->SetName("gr_fast_update");
+    gr_fast_update->SetTitle("FastContainerInsertErase");
+    gr_fast_update->SetLineColor(kBlue);
+
+    int max_pow = 15;
+    int testN = 1e4;
+    int nTicks = 100;
+    int nChanges = 5;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N + nTicks * nChanges);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // every tick replaces the oldest nChanges points by new ones
+        std::vector<std::pair<int, double>> added;
+        for (int i=0; i<nTicks * nChanges; i++)
+            added.emplace_back(N + i, udist(gen));
+
+        // TEST FULL REBUILD
+        FastContainer<double> fcSet(-200, 200);
+        std::vector<std::pair<int, double>> current(vec);
+        auto startSet = std::chrono::high_resolution_clock::now();
+        for (int tick = 0; tick < nTicks; ++tick)
+        {
+            current.erase(current.begin(), current.begin() + std::min<int>(nChanges, current.size()));
+            current.insert(current.end(), added.begin() + tick * nChanges, added.begin() + (tick + 1) * nChanges);
+            fcSet.set(current);
+        }
+        auto stopSet = std::chrono::high_resolution_clock::now();
+        auto durationSet = std::chrono::duration_cast<std::chrono::microseconds>(stopSet - startSet);
+        if (verbose) std::cout << "Rebuild duration: " << durationSet.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        FastContainer<double> fc(-200, 200);
+        fc.set(vec);
+        int oldest = 0;
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (int tick = 0; tick < nTicks; ++tick)
+        {
+            // same points as for the rebuild: the ids present are [oldest, N + tick * nChanges)
+            for (int i = 0; i < nChanges && oldest < N + tick * nChanges; ++i)
+                fc.erase(oldest++);
+            for (int i = tick * nChanges; i < (tick + 1) * nChanges; ++i)
+                fc.insert(added.at(i).first, added.at(i).second);
+        }
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Insert/erase duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_fast_set->AddPoint(N, durationSet.count());
+        gr_fast_update->AddPoint(N, durationF.count());
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            const double elem = udist(gen);
+            auto it = std::min_element(current.begin(), current.end(), [&elem](const auto& lhs, const auto& rhs){
+                return std::abs(lhs.second-elem) < std::abs(rhs.second-elem);
+            });
+            const int idx = *(fc.getClosestId(elem).first);
+            if (it->first == idx)
+                continue;
+
+            mismatch() << elem << " \t" << it->first << " " << it->second << "\t" << idx << std::endl;
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison of updates");
+    mg->Add(gr_fast_set);
+    mg->Add(gr_fast_update);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_fast_set");
+    legend->AddEntry("gr_fast_update");
+    legend->Draw();
+
+    c->SaveAs("testUpdates.png");
+}
+
+void testBuild(bool verbose)
+{
+    // create randomer
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_set = new TGraph(); 
+    gr_set->SetName("gr_set");
+    gr_set->SetTitle("Multiset");
+    gr_set->SetLineColor(kGreen);
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainerQuantile");
+    gr_fast->SetLineColor(kBlue);
+
+    // the uniform bucketing needs too many cells for the largest inputs
+    int max_pow = 24;
+
+    for (int ipow = 10; ipow < max_pow; ipow += 2)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // TEST ORDERED SET, the sort used to build the container before
+        auto startSet = std::chrono::high_resolution_clock::now();
+        auto comp = [](const std::pair<int, double>& lhs, const std::pair<int, double>& rhs)
+        {
+            return lhs.second < rhs.second;
+        };
+        std::multiset<std::pair<int, double>, decltype(comp)> tmp_multiset (vec.begin(), vec.end(), comp);
+        auto stopSet = std::chrono::high_resolution_clock::now();
+        auto durationSet = std::chrono::duration_cast<std::chrono::microseconds>(stopSet - startSet);
+        if (verbose) std::cout << "Multiset duration: " << durationSet.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        auto startF = std::chrono::high_resolution_clock::now();
+        FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+        fc.set(vec);
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Set duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_set->AddPoint(N, durationSet.count());
+        gr_fast->AddPoint(N, durationF.count());
+
+        // compare order
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        const auto& [fit, lit] = fc.getIdsInRange(-200, 200);
+        if (!std::equal(fit, lit, tmp_multiset.begin(), tmp_multiset.end(), [](int id, const auto& elem){ return id == elem.first; }))
+            mismatch() << "Different order" << std::endl;
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    c->cd()->SetLogx();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison of build time");
+    mg->Add(gr_set);
+    mg->Add(gr_fast);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_set");
+    legend->AddEntry("gr_fast");
+    legend->Draw();
+
+    c->SaveAs("testBuild.png");
+}
+
+void testIntegerKeys(bool verbose)
+{
+    // create randomer: nanosecond timestamps over ~11 days, ids of 32 bits.
+    // Integer keys are bucketed exactly, the double keys of the same values lose the last bits
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    const int64_t lower = 1700000000000000000;
+    const int64_t upper = lower + 1000000000000000;
+    std::uniform_int_distribution<int64_t> udist(lower, upper);
+
+    TGraph* gr_set = new TGraph(); 
+    gr_set->SetName("gr_set");
+    gr_set->SetTitle("Set");
+    gr_set->SetLineColor(kGreen);
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainerInt64");
+    gr_fast->SetLineColor(kBlue);
+    TGraph* gr_fast_double = new TGraph(); 
+    gr_fast_double->SetName("gr_fast_double");
+    gr_fast_double->SetTitle("FastContainerDouble");
+    gr_fast_double->SetLineColor(kBlack);
+
+    int max_pow = 16;
+    int testN = 1e5;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<uint32_t, int64_t>> vec;
+        std::vector<std::pair<int, double>> vecDouble;
+        vec.reserve(N);
+        vecDouble.reserve(N);
+        for (int i=0; i<N; i++)
+        {
+            vec.emplace_back(i, udist(gen));
+            vecDouble.emplace_back(i, vec.back().second - lower);
+        }
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<int64_t> test;
+        std::vector<double> testDouble;
+        test.reserve(testN);
+        testDouble.reserve(testN);
+        for (int i = 0; i<testN; i++)
+        {
+            test.push_back(udist(gen));
+            testDouble.push_back(test.back() - lower);
+        }
+
+        // TEST SET SOLUTION
+        auto startSet = std::chrono::high_resolution_clock::now();
+        auto comp = [](const std::pair<uint32_t, int64_t>& lhs, const std::pair<uint32_t, int64_t>& rhs)
+        {
+            return lhs.second < rhs.second;
+        };
+        std::set<std::pair<uint32_t, int64_t>, decltype(comp)> tmp_set (vec.begin(), vec.end(), comp);
+
+        std::vector<uint32_t> resSet;
+        resSet.reserve(testN);
+        for (const auto& elem: test)
+        {
+            auto it = tmp_set.lower_bound({0, elem});
+            auto pit = it == tmp_set.begin() ? it : std::prev(it);
+            it = it == tmp_set.end() ? pit : it;
+            resSet.push_back(it->second - elem < elem - pit->second ? it->first : pit->first);
+        }
+        auto stopSet = std::chrono::high_resolution_clock::now();
+        auto durationSet = std::chrono::duration_cast<std::chrono::microseconds>(stopSet - startSet);
+        if (verbose) std::cout << "Set duration: " << durationSet.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        auto startF = std::chrono::high_resolution_clock::now();
+        FastContainer<int64_t, uint32_t> fc(lower, upper);
+        fc.set(vec);
+
+        std::vector<uint32_t> resF;
+        resF.reserve(testN);
+        for (const auto& elem: test)
+            resF.push_back(*(fc.getClosestId(elem).first));
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose){
+            std::cout << "New duration: " << durationF.count() << ", muSec" << std::endl;
+            std::cout << "Number of cells: " << fc.getNCells() << std::endl;
+        }
+
+        auto startD = std::chrono::high_resolution_clock::now();
+        FastContainer<double> fcD(0, upper - lower);
+        fcD.set(vecDouble);
+
+        std::vector<int> resD;
+        resD.reserve(testN);
+        for (const auto& elem: testDouble)
+            resD.push_back(*(fcD.getClosestId(elem).first));
+        auto stopD = std::chrono::high_resolution_clock::now();
+        auto durationD = std::chrono::duration_cast<std::chrono::microseconds>(stopD - startD);
+        if (verbose) std::cout << "Double duration: " << durationD.count() << ", muSec" << std::endl;
+
+        gr_set->AddPoint(N, durationSet.count());
+        gr_fast->AddPoint(N, durationF.count());
+        gr_fast_double->AddPoint(N, durationD.count());
+
+        // compare values, the integer keys must give the exact distance
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        if (resSet.size() != resF.size())
+            mismatch() << "Different sizes" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            const int64_t distSet = std::abs(test.at(i) - vec.at(resSet.at(i)).second);
+            const int64_t distF = std::abs(test.at(i) - vec.at(resF.at(i)).second);
+            if (distSet == distF)
+                continue;
+
+            mismatch() << test.at(i) << " \t" << resSet.at(i) << " " << vec.at(resSet.at(i)).second << "\t" << distSet << std::endl;
+            std::cout << "\t\t" << resF.at(i) << " " << vec.at(resF.at(i)).second << "\t" << distF << std::endl;
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison getNearest, integer keys");
+    mg->Add(gr_set);
+    mg->Add(gr_fast);
+    mg->Add(gr_fast_double);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_set");
+    legend->AddEntry("gr_fast");
+    legend->AddEntry("gr_fast_double");
+    legend->Draw();
+
+    c->SaveAs("testIntegerKeys.png");
+}
+
+void testCompact(bool verbose)
+{
+    // create randomer
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainer");
+    gr_fast->SetLineColor(kBlue);
+    TGraph* gr_compact = new TGraph(); 
+    gr_compact->SetName("gr_compact");
+    gr_compact->SetTitle("CompactFastContainer");
+    gr_compact->SetLineColor(kRed);
+
+    TGraph* gr_mem_fast = new TGraph(); 
+    gr_mem_fast->SetName("gr_mem_fast");
+    gr_mem_fast->SetTitle("FastContainer");
+    gr_mem_fast->SetLineColor(kBlue);
+    TGraph* gr_mem_compact = new TGraph(); 
+    gr_mem_compact->SetName("gr_mem_compact");
+    gr_mem_compact->SetTitle("CompactFastContainer");
+    gr_mem_compact->SetLineColor(kRed);
+
+    int max_pow = 18;
+    int testN = 1e6;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        FastContainer<double> fc(-200, 200);
+        fc.set(vec);
+        std::vector<int> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const auto& elem: test)
+            resF.push_back(*(fc.getClosestId(elem).first));
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+
+        CompactFastContainer<double> cfc(-200, 200);
+        cfc.set(vec);
+        std::vector<int> resC;
+        resC.reserve(testN);
+        auto startC = std::chrono::high_resolution_clock::now();
+        for (const auto& elem: test)
+            resC.push_back(*(cfc.getClosestId(elem).first));
+        auto stopC = std::chrono::high_resolution_clock::now();
+        auto durationC = std::chrono::duration_cast<std::chrono::microseconds>(stopC - startC);
+
+        const double memF = double(fc.getMemoryUsage()) / N;
+        const double memC = double(cfc.getMemoryUsage()) / N;
+        if (verbose){
+            std::cout << "New duration: " << durationF.count() << ", muSec" << std::endl;
+            std::cout << "Compact duration: " << durationC.count() << ", muSec" << std::endl;
+            std::cout << "Memory per point: " << memF << " vs " << memC << " compact, bytes" << std::endl;
+        }
+
+        gr_fast->AddPoint(N, durationF.count());
+        gr_compact->AddPoint(N, durationC.count());
+        gr_mem_fast->AddPoint(N, memF);
+        gr_mem_compact->AddPoint(N, memC);
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            if (resF.at(i) == resC.at(i) || std::abs(vec.at(resF.at(i)).second - test.at(i)) == std::abs(vec.at(resC.at(i)).second - test.at(i)))
+                continue;
+
+            mismatch() << test.at(i) << " \t" << resF.at(i) << " " << vec.at(resF.at(i)).second << std::endl;
+            std::cout << "\t\t" << resC.at(i) << " " << vec.at(resC.at(i)).second << std::endl;
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison getNearest, compact layout");
+    mg->Add(gr_fast);
+    mg->Add(gr_compact);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_fast");
+    legend->AddEntry("gr_compact");
+    legend->Draw();
+
+    c->SaveAs("testCompact.png");
+
+    TCanvas* cMem = new TCanvas("cMem", "Memory", 900, 900);
+    cMem->cd()->SetGrid();
+    cMem->cd()->SetLogy();
+    TMultiGraph* mgMem = new TMultiGraph("mgMem", "Memory per point");
+    mgMem->Add(gr_mem_fast);
+    mgMem->Add(gr_mem_compact);
+    mgMem->GetXaxis()->SetTitle("Number of values");
+    mgMem->GetYaxis()->SetTitle("Bytes per point");
+    mgMem->Draw("AL");
+
+    TLegend* legendMem = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legendMem->AddEntry("gr_mem_fast");
+    legendMem->AddEntry("gr_mem_compact");
+    legendMem->Draw();
+
+    cMem->SaveAs("testCompactMemory.png");
+}
+
+void testKClosest(bool verbose)
+{
+    // create randomer, a part of the values is repeated to get runs of ids
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_set = new TGraph(); 
+    gr_set->SetName("gr_set");
+    gr_set->SetTitle("Set");
+    gr_set->SetLineColor(kGreen);
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainer");
+    gr_fast->SetLineColor(kBlue);
+
+    int max_pow = 16;
+    int testN = 1e5;
+    int k = 8;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, i % 4 == 3 ? vec.at(i / 2).second : udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        // TEST SET SOLUTION: walk both ways from lower_bound
+        auto comp = [](const std::pair<int, double>& lhs, const std::pair<int, double>& rhs)
+        {
+            return lhs.second < rhs.second;
+        };
+        std::multiset<std::pair<int, double>, decltype(comp)> tmp_multiset (vec.begin(), vec.end(), comp);
+
+        std::vector<std::vector<int>> resSet(testN);
+        auto startSet = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < testN; i++)
+        {
+            const double elem = test[i];
+            auto rit = tmp_multiset.lower_bound({0, elem});
+            auto lit = rit;
+            auto& res = resSet[i];
+            while (res.size() < k && (lit != tmp_multiset.begin() || rit != tmp_multiset.end()))
+            {
+                if (rit == tmp_multiset.end() || (lit != tmp_multiset.begin() && elem - std::prev(lit)->second <= rit->second - elem))
+                    res.push_back((--lit)->first);
+                else
+                    res.push_back((rit++)->first);
+            }
+        }
+        auto stopSet = std::chrono::high_resolution_clock::now();
+        auto durationSet = std::chrono::duration_cast<std::chrono::microseconds>(stopSet - startSet);
+        if (verbose) std::cout << "Set duration: " << durationSet.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        FastContainer<double> fc(-200, 200);
+        fc.set(vec);
+
+        std::vector<std::vector<int>> resF(testN);
+        std::vector<int> out;
+        out.reserve(k);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < testN; i++)
+        {
+            fc.getKClosest(test[i], k, out);
+            resF[i].assign(out.begin(), out.end());
+        }
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "New duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_set->AddPoint(N, durationSet.count());
+        gr_fast->AddPoint(N, durationF.count());
+
+        // compare distances in order, equal values may give other ids
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            bool same = resSet.at(i).size() == resF.at(i).size();
+            for (int j = 0; same && j < resF.at(i).size(); ++j)
+                same = std::abs(vec.at(resSet.at(i).at(j)).second - test.at(i)) == std::abs(vec.at(resF.at(i).at(j)).second - test.at(i));
+            if (same)
+                continue;
+
+            mismatch() << test.at(i) << " \t";
+            for (const int id: resSet.at(i))
+                std::cout << vec.at(id).second << " ";
+            std::cout << std::endl << "\t\t";
+            for (const int id: resF.at(i))
+                std::cout << vec.at(id).second << " ";
+            std::cout << std::endl;
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison getKClosest");
+    mg->Add(gr_set);
+    mg->Add(gr_fast);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_set");
+    legend->AddEntry("gr_fast");
+    legend->Draw();
+
+    c->SaveAs("testKClosest.png");
+}
+
+void testND(bool verbose)
+{
+    // create randomer: points in a cube, nearest and box queries against brute force
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_std = new TGraph(); 
+    gr_std->SetName("gr_std");
+    gr_std->SetTitle("BruteForce");
+    gr_std->SetLineColor(kRed);
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainerND");
+    gr_fast->SetLineColor(kBlue);
+    TGraph* gr_fast_box = new TGraph(); 
+    gr_fast_box->SetName("gr_fast_box");
+    gr_fast_box->SetTitle("FastContainerNDBox");
+    gr_fast_box->SetLineColor(kBlack);
+
+    using Point = FastContainerND<3>::Point;
+    auto dist2 = [](const Point& lhs, const Point& rhs)
+    {
+        return (lhs[0] - rhs[0]) * (lhs[0] - rhs[0]) + (lhs[1] - rhs[1]) * (lhs[1] - rhs[1]) + (lhs[2] - rhs[2]) * (lhs[2] - rhs[2]);
+    };
+
+    int max_pow = 16;
+    int testN = 1e4;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, Point>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, Point{udist(gen), udist(gen), udist(gen)});
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<Point> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back({udist(gen), udist(gen), udist(gen)});
+
+        // TEST STD SOLUTION
+        auto startStd = std::chrono::high_resolution_clock::now();
+        std::vector<int> resStd;
+        resStd.reserve(testN);
+        for (const auto& elem: test)
+        {
+            auto it = std::min_element(vec.begin(), vec.end(), [&](const auto& lhs, const auto& rhs){
+                return dist2(lhs.second, elem) < dist2(rhs.second, elem);
+            });
+            resStd.push_back(it->first);
+        }
+        auto stopStd = std::chrono::high_resolution_clock::now();
+        auto durationStd = std::chrono::duration_cast<std::chrono::microseconds>(stopStd - startStd);
+        if (verbose) std::cout << "Std duration: " << durationStd.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        FastContainerND<3> fc({-200, -200, -200}, {200, 200, 200});
+        fc.set(vec);
+
+        std::vector<int> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const auto& elem: test)
+            resF.push_back(*fc.getClosestId(elem));
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose){
+            std::cout << "New duration: " << durationF.count() << ", muSec" << std::endl;
+            std::cout << "Number of cells: " << fc.getNCells() << std::endl;
+        }
+
+        // boxes of 20 around the test points
+        std::vector<int> out;
+        std::vector<std::vector<int>> resBox(testN);
+        auto startBox = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < testN; i++)
+        {
+            const auto& elem = test[i];
+            fc.getIdsInBox({elem[0] - 10, elem[1] - 10, elem[2] - 10}, {elem[0] + 10, elem[1] + 10, elem[2] + 10}, out);
+            resBox[i].assign(out.begin(), out.end());
+        }
+        auto stopBox = std::chrono::high_resolution_clock::now();
+        auto durationBox = std::chrono::duration_cast<std::chrono::microseconds>(stopBox - startBox);
+        if (verbose) std::cout << "Box duration: " << durationBox.count() << ", muSec" << std::endl;
+
+        gr_std->AddPoint(N, durationStd.count());
+        gr_fast->AddPoint(N, durationF.count());
+        gr_fast_box->AddPoint(N, durationBox.count());
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            const auto& elem = test.at(i);
+            if (dist2(vec.at(resStd.at(i)).second, elem) != dist2(vec.at(resF.at(i)).second, elem))
+                mismatch() << "Nearest " << i << " \t" << resStd.at(i) << " " << resF.at(i) << std::endl;
+
+            std::vector<int> box;
+            for (const auto& [id, point]: vec)
+            {
+                if (std::abs(point[0] - elem[0]) <= 10 && std::abs(point[1] - elem[1]) <= 10 && std::abs(point[2] - elem[2]) <= 10)
+                    box.push_back(id);
+            }
+            std::sort(resBox.at(i).begin(), resBox.at(i).end());
+            if (box != resBox.at(i))
+                mismatch() << "Box " << i << " \t" << box.size() << " " << resBox.at(i).size() << std::endl;
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison getNearest, 3D");
+    mg->Add(gr_std);
+    mg->Add(gr_fast);
+    mg->Add(gr_fast_box);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_std");
+    legend->AddEntry("gr_fast");
+    legend->AddEntry("gr_fast_box");
+    legend->Draw();
+
+    c->SaveAs("testND.png");
+}
+
+void testConcurrent(bool verbose)
+{
+    // readers query while one writer rebuilds the container all the time.
+    // Ids carry the generation of their input, ids of one snapshot must come from one generation
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_mutex = new TGraph(); 
+    gr_mutex->SetName("gr_mutex");
+    gr_mutex->SetTitle("FastContainerWithMutex");
+    gr_mutex->SetLineColor(kGreen);
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("ConcurrentFastContainer");
+    gr_fast->SetLineColor(kBlue);
+
+    const int N = 1 << 14;
+    const int nGenerations = 8;
+    const int testN = 1e6;
+    const int maxReaders = std::max<int>(std::thread::hardware_concurrency() - 1, 1);
+
+    std::vector<std::vector<std::pair<int, double>>> inputs(nGenerations);
+    for (int g = 0; g < nGenerations; ++g)
+    {
+        for (int i = 0; i < N; ++i)
+            inputs[g].emplace_back(g * N + i, udist(gen));
+    }
+    std::vector<double> test;
+    test.reserve(testN);
+    for (int i = 0; i < testN; i++)
+        test.push_back(udist(gen));
+
+    for (int nReaders = 1; nReaders <= maxReaders; ++nReaders)
+    {
+        std::cout << "Readers number: " << nReaders << std::endl;
+
+        // every reader takes its part of the queries, the writer runs until they are done.
+        // Returns the time of the readers
+        auto run = [&](auto query, auto rebuild)
+        {
+            std::atomic<bool> done{false};
+            std::thread writer([&]()
+            {
+                for (int g = 0; !done.load(); g = (g + 1) % nGenerations)
+                    rebuild(inputs[g]);
+            });
+
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> readers;
+            for (int reader = 0; reader < nReaders; ++reader)
+                readers.emplace_back([&, reader]()
+                {
+                    for (int i = reader; i + 1 < testN; i += 2 * nReaders)
+                        query(test[i], test[i + 1]);
+                });
+            for (auto& reader: readers)
+                reader.join();
+            auto stop = std::chrono::high_resolution_clock::now();
+
+            done.store(true);
+            writer.join();
+            return std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+        };
+
+        // TEST MUTEX SOLUTION
+        std::atomic<int> tornMutex{0};
+        std::mutex mutex;
+        FastContainer<double> fcMutex(-200, 200);
+        fcMutex.set(inputs[0]);
+        auto durationMutex = run([&](double z1, double z2)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (*fcMutex.getClosestId(z1).first / N != *fcMutex.getClosestId(z2).first / N)
+                ++tornMutex;
+        },
+        [&](const std::vector<std::pair<int, double>>& input)
+        {
+            FastContainer<double> next(-200, 200);
+            next.set(input);
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(fcMutex, next);
+        });
+        if (verbose) std::cout << "Mutex duration: " << durationMutex.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        std::atomic<int> torn{0};
+        ConcurrentFastContainer<double> fc(-200, 200);
+        fc.set(inputs[0]);
+        auto durationF = run([&](double z1, double z2)
+        {
+            auto snapshot = fc.getSnapshot();
+            if (*snapshot->getClosestId(z1).first / N != *snapshot->getClosestId(z2).first / N)
+                ++torn;
+        },
+        [&](const std::vector<std::pair<int, double>>& input)
+        {
+            fc.set(input);
+        });
+        if (verbose){
+            std::cout << "New duration: " << durationF.count() << ", muSec" << std::endl;
+            std::cout << "Retired containers: " << fc.getNRetired() << std::endl;
+        }
+
+        gr_mutex->AddPoint(nReaders, durationMutex.count());
+        gr_fast->AddPoint(nReaders, durationF.count());
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        if (tornMutex.load() != 0 || torn.load() != 0)
+            mismatch() << "Mixed generations: " << tornMutex.load() << " " << torn.load() << std::endl;
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison getNearest during rebuilds");
+    mg->Add(gr_mutex);
+    mg->Add(gr_fast);
+    mg->GetXaxis()->SetTitle("Number of readers");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_mutex");
+    legend->AddEntry("gr_fast");
+    legend->Draw();
+
+    c->SaveAs("testConcurrent.png");
+}
+
+void testMapped(bool verbose)
+{
+    // build once and save, then compare the build with mapping the saved file
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainerSet");
+    gr_fast->SetLineColor(kBlue);
+    TGraph* gr_mapped = new TGraph(); 
+    gr_mapped->SetName("gr_mapped");
+    gr_mapped->SetTitle("FastContainerMapFrom");
+    gr_mapped->SetLineColor(kRed);
+
+    const std::string path = "testMapped.bin";
+    int max_pow = 24;
+    int testN = 1e5;
+
+    for (int ipow = 10; ipow < max_pow; ipow += 2)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        // TEST BUILD
+        auto startF = std::chrono::high_resolution_clock::now();
+        FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+        fc.set(vec);
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Set duration: " << durationF.count() << ", muSec" << std::endl;
+        fc.save(path);
+
+        // TEST NEW SOLUTION
+        auto startM = std::chrono::high_resolution_clock::now();
+        auto mapped = FastContainer<double>::mapFrom(path);
+        auto stopM = std::chrono::high_resolution_clock::now();
+        auto durationM = std::chrono::duration_cast<std::chrono::microseconds>(stopM - startM);
+        if (verbose) std::cout << "MapFrom duration: " << durationM.count() << ", muSec" << std::endl;
+
+        gr_fast->AddPoint(N, durationF.count());
+        gr_mapped->AddPoint(N, std::max<int>(durationM.count(), 1));
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (const auto& elem: test)
+        {
+            const auto& [fit, lit] = fc.getClosestId(elem);
+            const auto& [mfit, mlit] = mapped.getClosestId(elem);
+            if (!std::equal(fit, lit, mfit, mlit))
+                mismatch() << elem << " \t" << *fit << " " << *mfit << std::endl;
+        }
+        if (mapped.getMaxSize() != fc.getMaxSize() || mapped.getNCells() != fc.getNCells())
+            mismatch() << "Mapped parameters differ: " << mapped.getMaxSize() << " " << mapped.getNCells() << std::endl;
+    }
+    std::remove(path.c_str());
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    c->cd()->SetLogx();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison of set() and mapFrom()");
+    mg->Add(gr_fast);
+    mg->Add(gr_mapped);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_fast");
+    legend->AddEntry("gr_mapped");
+    legend->Draw();
+
+    c->SaveAs("testMapped.png");
+}
+
+void testStreaming(bool verbose)
+{
+    // create randomer: timestamps with exponential gaps, every tick appends new ones and expires the old ones.
+    // The window is queried after every tick, the rebuild uses the window bounds of the tick
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::exponential_distribution<> edist(1.0);
+    std::uniform_real_distribution<> udist(0.0, 1.0);
+
+    TGraph* gr_fast_set = new TGraph(); 
+    gr_fast_set->SetName("gr_fast_set");
+    gr_fast_set->SetTitle("FastContainerSet");
+    gr_fast_set->SetLineColor(kBlue);
+    TGraph* gr_stream = new TGraph(); 
+    gr_stream->SetName("gr_stream");
+    gr_stream->SetTitle("StreamingFastContainer");
+    gr_stream->SetLineColor(kRed);
+
+    int max_pow = 16;
+    int nTicks = 100;
+    int nAppends = 100;
+    int nQueries = 100;
+
+    for (int ipow = 8; ipow < max_pow; ++ipow)
+    {
+        // the window holds about N points
+        int N = pow(2, ipow);
+        std::cout << "Window number: " << N << std::endl;
+        const double window = N;
+
+        // input data: the filled window and the appends of every tick
+        std::vector<std::pair<int, double>> vec;
+        double t = 0;
+        for (int i = 0; i < N + nTicks * nAppends; ++i)
+        {
+            t += edist(gen);
+            vec.emplace_back(i, t);
+        }
+        std::vector<double> test;
+        for (int i = 0; i < nTicks * nQueries; ++i)
+            test.push_back(udist(gen));
+
+        // TEST FULL REBUILD
+        std::vector<int> resSet;
+        resSet.reserve(nTicks * nQueries);
+        auto startSet = std::chrono::high_resolution_clock::now();
+        int head = 0;
+        for (int tick = 0; tick < nTicks; ++tick)
+        {
+            const int tail = N + (tick + 1) * nAppends;
+            const double back = vec[tail - 1].second;
+            while (vec[head].second < back - window)
+                ++head;
+
+            FastContainer<double> fc(back - window, back + 1);
+            fc.set(std::vector<std::pair<int, double>>(vec.begin() + head, vec.begin() + tail));
+            for (int i = tick * nQueries; i < (tick + 1) * nQueries; ++i)
+                resSet.push_back(*fc.getClosestId(back - window * test[i]).first);
+        }
+        auto stopSet = std::chrono::high_resolution_clock::now();
+        auto durationSet = std::chrono::duration_cast<std::chrono::microseconds>(stopSet - startSet);
+        if (verbose) std::cout << "Rebuild duration: " << durationSet.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        StreamingFastContainer<double> sfc(1.0);
+        for (int i = 0; i < N; ++i)
+            sfc.append(vec[i].first, vec[i].second);
+
+        std::vector<int> resF;
+        resF.reserve(nTicks * nQueries);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (int tick = 0; tick < nTicks; ++tick)
+        {
+            for (int i = N + tick * nAppends; i < N + (tick + 1) * nAppends; ++i)
+                sfc.append(vec[i].first, vec[i].second);
+            const double back = sfc.getBack();
+            sfc.expireBefore(back - window);
+            for (int i = tick * nQueries; i < (tick + 1) * nQueries; ++i)
+                resF.push_back(*sfc.getClosestId(back - window * test[i]).first);
+        }
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose){
+            std::cout << "Streaming duration: " << durationF.count() << ", muSec" << std::endl;
+            std::cout << "Number of cells: " << sfc.getNCells() << std::endl;
+        }
+
+        gr_fast_set->AddPoint(N, durationSet.count());
+        gr_stream->AddPoint(N, durationF.count());
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < nTicks * nQueries; i++)
+        {
+            const double z = vec[N + (i / nQueries + 1) * nAppends - 1].second - window * test[i];
+            if (resSet.at(i) == resF.at(i) || std::abs(vec.at(resSet.at(i)).second - z) == std::abs(vec.at(resF.at(i)).second - z))
+                continue;
+
+            mismatch() << z << " \t" << resSet.at(i) << " " << vec.at(resSet.at(i)).second << std::endl;
+            std::cout << "\t\t" << resF.at(i) << " " << vec.at(resF.at(i)).second << std::endl;
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    c->cd()->SetLogx();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison of a sliding window");
+    mg->Add(gr_fast_set);
+    mg->Add(gr_stream);
+    mg->GetXaxis()->SetTitle("Number of values in the window");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_fast_set");
+    legend->AddEntry("gr_stream");
+    legend->Draw();
+
+    c->SaveAs("testStreaming.png");
+}
+
+void testAggregates(bool verbose)
+{
+    // create randomer: wide ranges over weighted points, iterating the ids against the aggregates
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+    std::uniform_real_distribution<> wdist(0.0, 1.0);
+
+    TGraph* gr_std = new TGraph(); 
+    gr_std->SetName("gr_std");
+    gr_std->SetTitle("IterateIdsInRange");
+    gr_std->SetLineColor(kRed);
+    TGraph* gr_fast = new TGraph(); 
+    gr_fast->SetName("gr_fast");
+    gr_fast->SetTitle("FastContainerAggregates");
+    gr_fast->SetLineColor(kBlue);
+
+    int max_pow = 21;
+    int testN = 1e4;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        std::vector<double> weights;
+        vec.reserve(N);
+        weights.reserve(N);
+        for (int i=0; i<N; i++)
+        {
+            vec.emplace_back(i, udist(gen));
+            weights.push_back(wdist(gen));
+        }
+
+        // generate test ranges
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<std::pair<double, double>> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+        {
+            const double lower = udist(gen);
+            const double upper = udist(gen);
+            test.emplace_back(std::min(lower, upper), std::max(lower, upper));
+        }
+
+        FastContainer<double> fc(-200, 200);
+        fc.set(vec);
+        fc.setWeights([&weights](int id){ return weights[id]; });
+
+        // TEST STD SOLUTION
+        std::vector<std::array<double, 4>> resStd;
+        resStd.reserve(testN);
+        auto startStd = std::chrono::high_resolution_clock::now();
+        for (const auto& [lower, upper]: test)
+        {
+            const auto& [fit, lit] = fc.getIdsInRange(lower, upper);
+            std::array<double, 4> res = {0, 0, std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+            for (auto it = fit; it != lit; ++it)
+            {
+                res[0] += 1;
+                res[1] += weights[*it];
+                res[2] = std::min(res[2], weights[*it]);
+                res[3] = std::max(res[3], weights[*it]);
+            }
+            resStd.push_back(res);
+        }
+        auto stopStd = std::chrono::high_resolution_clock::now();
+        auto durationStd = std::chrono::duration_cast<std::chrono::microseconds>(stopStd - startStd);
+        if (verbose) std::cout << "Iterate duration: " << durationStd.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        std::vector<std::array<double, 4>> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const auto& [lower, upper]: test)
+        {
+            const auto [min, max] = fc.minMaxInRange(lower, upper);
+            resF.push_back({double(fc.countInRange(lower, upper)), fc.sumInRange(lower, upper), min, max});
+        }
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Aggregates duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_std->AddPoint(N, durationStd.count());
+        gr_fast->AddPoint(N, durationF.count());
+
+        // compare values, the sums are rounded differently
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            const auto& res = resStd.at(i);
+            const auto& resAgg = resF.at(i);
+            if (res[0] == resAgg[0] && std::abs(res[1] - resAgg[1]) <= 1e-9 * N && res[2] == resAgg[2] && res[3] == resAgg[3])
+                continue;
+
+            mismatch() << test.at(i).first << " " << test.at(i).second << " \t" << res[0] << " " << res[1] << " " << res[2] << " " << res[3] << std::endl;
+            std::cout << "\t\t" << resAgg[0] << " " << resAgg[1] << " " << resAgg[2] << " " << resAgg[3] << std::endl;
+        }
+    }
+
+    TCanvas* c = new TCanvas("c", "Comparison", 900, 900);
+    c->cd()->SetGrid();
+    c->cd()->SetLogy();
+    TMultiGraph* mg = new TMultiGraph("mg", "Comparison of range aggregates");
+    mg->Add(gr_std);
+    mg->Add(gr_fast);
+    mg->GetXaxis()->SetTitle("Number of values");
+    mg->GetYaxis()->SetTitle("Time, #muS");
+    mg->Draw("AL");
+
+    TLegend* legend = new TLegend(0.7, 0.6, 0.95, 0.7);
+    legend->AddEntry("gr_std");
+    legend->AddEntry("gr_fast");
+    legend->Draw();
+
+    c->SaveAs("testAggregates.png");
+}
+
+void testStats(bool verbose)
+{
+    // create randomer: uniform background with one gaussian cluster, the statistics show the empty cells of the uniform bucketing
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+    std::normal_distribution<> ndist(50.0, 1.0);
+
+    TGraph* gr_uniform = makeGraph("gr_uniform", "UniformEmptyCells", kRed);
+    TGraph* gr_gap = makeGraph("gr_gap", "UniformLongestEmptyGap", kGreen);
+    TGraph* gr_quantile = makeGraph("gr_quantile", "QuantileCells", kBlue);
+
+    int max_pow = 14;
+    int testN = 1e5;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data, every fourth value is repeated
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, i % 4 == 3 ? vec.back().second : (i % 2 ? udist(gen) : ndist(gen)));
+
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        for (auto bucketing: {Bucketing::Uniform, Bucketing::Quantile})
+        {
+            FastContainer<double> fc(-200, 200, bucketing);
+            fc.set(vec);
+            for (const double z: test)
+                fc.getClosestId(z);
+
+            // the histograms have to add up to the cells and the values
+            const ContainerStats stats = fc.getStats();
+            size_t nCells = 0;
+            size_t nValues = 0;
+            size_t nRuns = 0;
+            for (size_t size = 0; size < stats.occupancy.size(); ++size)
+            {
+                nCells += stats.occupancy[size];
+                nValues += size * stats.occupancy[size];
+            }
+            for (const size_t runs: stats.duplicateRuns)
+                nRuns += runs;
+            if (nCells != stats.nCells || nValues != stats.nValues || nRuns != stats.nValues || stats.nIds != N)
+                mismatch() << "Inconsistent statistics: " << nCells << " " << nValues << " " << nRuns << " " << stats.nIds << std::endl;
+
+            const QueryCounters counters = fc.getQueryCounters();
+            if (verbose)
+                std::cout << "Cells: " << stats.nCells << ", empty: " << stats.occupancy[0] << ", longest gap: " << stats.longestEmptyGap
+                    << ", longest run: " << stats.longestDuplicateRun << ", branches: " << counters.emptyCell << " " << counters.leftOfCell
+                    << " " << counters.rightOfCell << " " << counters.inCell << std::endl;
+
+            if (bucketing == Bucketing::Uniform)
+            {
+                gr_uniform->AddPoint(N, stats.occupancy[0]);
+                gr_gap->AddPoint(N, stats.longestEmptyGap);
+            }
+            else
+                gr_quantile->AddPoint(N, stats.nCells);
+        }
+    }
+
+    savePlot("testStats.png", "Cells of clustered input", {gr_uniform, gr_gap, gr_quantile}, "Number of values", "Cells", false, true);
+}
+
+void testMultiRanges(bool verbose)
+{
+    // create randomer: sorted, overlapping windows as the clustering issues them, quantile bucketing
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_single = makeGraph("gr_single", "GetIdsInRange", kRed);
+    TGraph* gr_fast = makeGraph("gr_fast", "ForEachInRanges", kBlue);
+
+    int max_pow = 21;
+    int testN = 1e5;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // windows of about 8 values sliding over the whole range
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<std::pair<double, double>> test;
+        test.reserve(testN);
+        const double width = 400. * 8 / N;
+        for (int i = 0; i<testN; i++)
+        {
+            const double lower = -200 + 400. * i / testN;
+            test.emplace_back(lower, std::min(lower + width, 200.));
+        }
+
+        FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+        fc.set(vec);
+
+        // TEST ONE CALL PER RANGE
+        std::vector<std::pair<long, long>> resSingle(testN);
+        auto startSingle = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < testN; ++i)
+        {
+            const auto& [fit, lit] = fc.getIdsInRange(test[i].first, test[i].second);
+            resSingle[i] = {lit - fit, fit != lit ? *fit : -1};
+        }
+        auto stopSingle = std::chrono::high_resolution_clock::now();
+        auto durationSingle = std::chrono::duration_cast<std::chrono::microseconds>(stopSingle - startSingle);
+        if (verbose) std::cout << "Single ranges duration: " << durationSingle.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        std::vector<std::pair<long, long>> resF(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        fc.forEachInRanges(test, [&resF](size_t i, auto fit, auto lit){
+            resF[i] = {lit - fit, fit != lit ? *fit : -1};
+        });
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Multi ranges duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_single->AddPoint(N, durationSingle.count());
+        gr_fast->AddPoint(N, durationF.count());
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            if (resSingle[i] == resF[i])
+                continue;
+
+            mismatch() << test[i].first << " " << test[i].second << " \t" << resSingle[i].first << " " << resSingle[i].second
+                << "\t\t" << resF[i].first << " " << resF[i].second << std::endl;
+        }
+    }
+
+    savePlot("testMultiRanges.png", "Comparison of multi range queries", {gr_single, gr_fast}, "Number of values", "Time, #muS", false, true);
+}
+
+void testKernel(bool verbose)
+{
+    // create randomer: the branch-free getClosestId against the checked search, quantile cells stay cache resident longer
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_checked = makeGraph("gr_checked", "Checked", kRed);
+    TGraph* gr_fast = makeGraph("gr_fast", "BranchFree", kBlue);
+
+    int max_pow = 18;
+    int testN = 1e6;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+        fc.setKernel(true);
+        fc.set(vec);
+
+        // TEST CHECKED SOLUTION
+        std::vector<FastContainer<double>::Range> resChecked;
+        resChecked.reserve(testN);
+        auto startChecked = std::chrono::high_resolution_clock::now();
+        for (const double z: test)
+            resChecked.push_back(fc.getClosestIdChecked(z));
+        auto stopChecked = std::chrono::high_resolution_clock::now();
+        auto durationChecked = std::chrono::duration_cast<std::chrono::microseconds>(stopChecked - startChecked);
+        if (verbose) std::cout << "Checked duration: " << durationChecked.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        std::vector<FastContainer<double>::Range> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const double z: test)
+            resF.push_back(fc.getClosestId(z));
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Branch-free duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_checked->AddPoint(N, durationChecked.count());
+        gr_fast->AddPoint(N, durationF.count());
+
+        // compare values, both have to return the same run of ids
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            if (resChecked[i] == resF[i])
+                continue;
+
+            mismatch() << test[i] << " \t" << *resChecked[i].first << " " << resChecked[i].second - resChecked[i].first
+                << "\t\t" << *resF[i].first << " " << resF[i].second - resF[i].first << std::endl;
+        }
+
+        // queries outside of the bounds take the nearest end
+        if (fc.getClosestId(-1e3) != fc.getClosestId(-200) || fc.getClosestId(1e3) != fc.getClosestId(200))
+            mismatch() << "Out of bounds query differs from the bound" << std::endl;
+    }
+
+    savePlot("testKernel.png", "Comparison of closest id kernels", {gr_checked, gr_fast}, "Number of values", "Time, #muS", false, true);
+}
+
+void testBulk(bool verbose)
+{
+    // create randomer: bulk queries on a ThreadPool of 1 to 2 * hardware threads against the serial getClosestIds
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_closest = makeGraph("gr_closest", "getClosestIds", kRed);
+    TGraph* gr_ranges = makeGraph("gr_ranges", "getIdsInRanges", kBlue);
+
+    int N = 1e6;
+    int testN = 1e7;
+    int maxThreads = 2 * std::max<int>(std::thread::hardware_concurrency(), 1);
+
+    // generate and fill input data
+    std::cout << "Input number: " << N << std::endl;
+    std::vector<std::pair<int, double>> vec;
+    vec.reserve(N);
+    for (int i=0; i<N; i++)
+        vec.emplace_back(i, udist(gen));
+
+    // generate test numbers and windows of about 16 values
+    std::cout << "Test number: " << testN << std::endl;
+    std::vector<double> test;
+    std::vector<FastContainer<double>::Interval> windows;
+    test.reserve(testN);
+    windows.reserve(testN);
+    for (int i = 0; i<testN; i++)
+    {
+        test.push_back(udist(gen));
+        windows.emplace_back(test.back(), test.back() + 400. * 16 / N);
+    }
+
+    FastContainer<double> fc(-200, 200);
+    fc.set(vec);
+
+    std::vector<int> resSerial;
+    fc.getClosestIds(test, resSerial);
+
+    for (int nThreads = 1; nThreads <= maxThreads; ++nThreads)
+    {
+        ThreadPool pool(nThreads);
+
+        std::vector<int> resF;
+        auto startF = std::chrono::high_resolution_clock::now();
+        fc.getClosestIds(test, resF, pool);
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << nThreads << " threads closest duration: " << durationF.count() << ", muSec" << std::endl;
+
+        std::vector<FastContainer<double>::Range> resR;
+        auto startR = std::chrono::high_resolution_clock::now();
+        fc.getIdsInRanges(windows, resR, pool);
+        auto stopR = std::chrono::high_resolution_clock::now();
+        auto durationR = std::chrono::duration_cast<std::chrono::microseconds>(stopR - startR);
+        if (verbose) std::cout << nThreads << " threads ranges duration: " << durationR.count() << ", muSec" << std::endl;
+
+        gr_closest->AddPoint(nThreads, durationF.count());
+        gr_ranges->AddPoint(nThreads, durationR.count());
+
+        // compare values, the threads must not change any result
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        if (resF != resSerial)
+            mismatch() << "Bulk getClosestIds differs with " << nThreads << " threads" << std::endl;
+        for (int i = 0; i < testN; i += 97)
+        {
+            if (resR[i] != fc.getIdsInRange(windows[i].first, windows[i].second))
+                mismatch() << windows[i].first << " \t" << windows[i].second << " differs with " << nThreads << " threads" << std::endl;
+        }
+    }
+
+    savePlot("testBulk.png", "Scaling of the bulk queries", {gr_closest, gr_ranges}, "Number of threads", "Time, #muS", false, false);
+}
+
+void testSharded(bool verbose)
+{
+    // create randomer: ShardedFastContainer against one FastContainer, the queries near shard bounds included
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_single = makeGraph("gr_single", "FastContainer set", kRed);
+    TGraph* gr_sharded = makeGraph("gr_sharded", "ShardedFastContainer set", kBlue);
+
+    int max_pow = 24;
+    int testN = 1e6;
+
+    for (int ipow = 10; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        // TEST ONE CONTAINER
+        FastContainer<double> fc(-200, 200);
+        auto startS = std::chrono::high_resolution_clock::now();
+        fc.set(vec);
+        auto stopS = std::chrono::high_resolution_clock::now();
+        auto durationS = std::chrono::duration_cast<std::chrono::microseconds>(stopS - startS);
+        if (verbose) std::cout << "Single set duration: " << durationS.count() << ", muSec" << std::endl;
+
+        // TEST SHARDS
+        ShardedFastContainer<double> sc(-200, 200, 16);
+        auto startF = std::chrono::high_resolution_clock::now();
+        sc.set(vec);
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Sharded set duration: " << durationF.count() << ", muSec, " << sc.getNShards() << " shards" << std::endl;
+
+        gr_single->AddPoint(N, durationS.count());
+        gr_sharded->AddPoint(N, durationF.count());
+
+        // the first values of the shards and their neighbours are the queries at the shard bounds
+        for (int shard = 1; shard < sc.getNShards(); ++shard)
+        {
+            const int id = *sc.getShard(shard).getClosestId(-200).first;
+            test.push_back(vec[id].second);
+            test.push_back(std::nextafter(vec[id].second, -200.));
+        }
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (const double z: test)
+        {
+            // values at the same distance may be taken from different sides
+            const auto single = fc.getClosestIdChecked(z);
+            const auto sharded = sc.getClosestId(z);
+            if (std::abs(vec[*single.first].second - z) == std::abs(vec[*sharded.first].second - z))
+                continue;
+
+            mismatch() << z << " \t" << *single.first << " " << single.second - single.first
+                << "\t\t" << *sharded.first << " " << sharded.second - sharded.first << std::endl;
+        }
+    }
+
+    savePlot("testSharded.png", "Comparison of the builds", {gr_single, gr_sharded}, "Number of values", "Time, #muS", true, true);
+}
+
+void testTuning(bool verbose)
+{
+    // create randomer: queries in a narrow band of uniform data, tune() tries every bucketing and cell size
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+    std::uniform_real_distribution<> band(10.0, 12.0);
+
+    TGraph* gr_predicted = makeGraph("gr_predicted", "Predicted", kRed);
+    TGraph* gr_measured = makeGraph("gr_measured", "Measured", kBlue);
+
+    int N = 1e6;
+    int testN = 1e5;
+
+    // generate and fill input data
+    std::cout << "Input number: " << N << std::endl;
+    std::vector<std::pair<int, double>> vec;
+    vec.reserve(N);
+    for (int i=0; i<N; i++)
+        vec.emplace_back(i, udist(gen));
+
+    // generate test numbers
+    std::cout << "Test number: " << testN << std::endl;
+    std::vector<double> test;
+    test.reserve(testN);
+    for (int i = 0; i<testN; i++)
+        test.push_back(band(gen));
+
+    FastContainer<double> fc(-200, 200);
+    const TuningReport report = fc.tune(vec, test);
+    for (int i = 0; i < report.candidates.size(); ++i)
+    {
+        const auto& candidate = report.candidates[i];
+        if (verbose) std::cout << (i == report.chosen ? "* " : "  ") << "bucketing " << int(candidate.bucketing) << " size " << candidate.maxSize
+            << " cells " << candidate.nCells << " memory " << candidate.memoryUsage << " predicted " << candidate.predictedNs
+            << " measured " << candidate.measuredNs << ", nSec" << std::endl;
+        gr_predicted->AddPoint(i, candidate.predictedNs);
+        gr_measured->AddPoint(i, candidate.measuredNs);
+    }
+
+    // compare values with the untuned container, the tuned one keeps its settings
+    if (verbose) std::cout << "Check solutions" << std::endl;
+    FastContainer<double> ref(-200, 200, Bucketing::Quantile);
+    ref.set(vec);
+    for (const double z: test)
+    {
+        const auto tuned = fc.getClosestIdChecked(z);
+        const auto untuned = ref.getClosestIdChecked(z);
+        if (std::abs(vec[*tuned.first].second - z) == std::abs(vec[*untuned.first].second - z))
+            continue;
+
+        mismatch() << z << " \t" << *untuned.first << "\t\t" << *tuned.first << std::endl;
+    }
+
+    // no configuration fits in one byte: tune throws and the container answers from the input with its own settings
+    FastContainer<double> failed(-200, 200);
+    bool thrown = false;
+    try
+    {
+        failed.tune(vec, test, 1);
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    if (!thrown || failed.getBucketing() != Bucketing::Uniform || failed.getMaxSize() != 5)
+        mismatch() << "Tuning without memory did not fail cleanly" << std::endl;
+    for (const double z: test)
+    {
+        const auto answer = failed.getClosestId(z);
+        const auto untuned = ref.getClosestIdChecked(z);
+        if (std::abs(vec[*answer.first].second - z) != std::abs(vec[*untuned.first].second - z))
+            mismatch() << z << " \t" << *untuned.first << "\t\t" << *answer.first << " after a failed tune" << std::endl;
+    }
+
+    savePlot("testTuning.png", "Latency of the tuned configurations", {gr_predicted, gr_measured}, "Configuration", "Time per query, nS", false, false);
+}
+
+// a 64 byte hit record as returned by the detector lookups
+struct TestHit
+{
+    double energy;
+    double time;
+    double position[3];
+    int64_t channel;
+    int64_t flags;
+    double quality;
+};
+
+void testPayload(bool verbose)
+{
+    // create randomer: the ids of FastContainer read back from the user array against the records of PayloadFastContainer
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_ids = makeGraph("gr_ids", "Ids", kRed);
+    TGraph* gr_payload = makeGraph("gr_payload", "Payload", kBlue);
+
+    int max_pow = 23;
+    int testN = 1e6;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        std::vector<TestHit> hits;
+        std::vector<PayloadFastContainer<double, TestHit>::Record> records;
+        vec.reserve(N);
+        hits.reserve(N);
+        records.reserve(N);
+        for (int i=0; i<N; i++)
+        {
+            const double value = udist(gen);
+            const TestHit hit = {value, value * 2, {value, -value, 0}, i, 0, 1};
+            vec.emplace_back(i, value);
+            hits.push_back(hit);
+            records.push_back({value, i, hit});
+        }
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        FastContainer<double> fc(-200, 200);
+        fc.set(vec);
+        PayloadFastContainer<double, TestHit> pc(-200, 200);
+        pc.set(std::move(records));
+
+        // TEST IDS AND THE USER ARRAY
+        std::vector<double> resIds;
+        resIds.reserve(testN);
+        auto startIds = std::chrono::high_resolution_clock::now();
+        for (const double z: test)
+            resIds.push_back(hits[*fc.getClosestId(z).first].energy);
+        auto stopIds = std::chrono::high_resolution_clock::now();
+        auto durationIds = std::chrono::duration_cast<std::chrono::microseconds>(stopIds - startIds);
+        if (verbose) std::cout << "Ids duration: " << durationIds.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        std::vector<double> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const double z: test)
+            resF.push_back(pc.getClosest(z)[0].payload.energy);
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Payload duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_ids->AddPoint(N, durationIds.count());
+        gr_payload->AddPoint(N, durationF.count());
+
+        // compare values
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            if (resIds[i] == resF[i])
+                continue;
+
+            mismatch() << test[i] << " \t" << resIds[i] << "\t\t" << resF[i] << std::endl;
+        }
+    }
+
+    savePlot("testPayload.png", "Comparison of ids and payload", {gr_ids, gr_payload}, "Number of values", "Time, #muS", true, false);
+}
+
+void testJoin(bool verbose)
+{
+    // create randomer: getClosestIds over unsorted queries against the sorted walk of nearestJoin
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_lookup = makeGraph("gr_lookup", "Lookups", kRed);
+    TGraph* gr_join = makeGraph("gr_join", "Join", kBlue);
+
+    int max_pow = 23;
+    int testN = 4e6;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+        fc.set(vec);
+
+        // TEST LOOKUPS
+        std::vector<int> resL;
+        auto startL = std::chrono::high_resolution_clock::now();
+        fc.getClosestIds(test, resL);
+        auto stopL = std::chrono::high_resolution_clock::now();
+        auto durationL = std::chrono::duration_cast<std::chrono::microseconds>(stopL - startL);
+        if (verbose) std::cout << "Lookups duration: " << durationL.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        std::vector<int> resF;
+        auto startF = std::chrono::high_resolution_clock::now();
+        fc.nearestJoin(test, resF);
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Join duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_lookup->AddPoint(N, durationL.count());
+        gr_join->AddPoint(N, durationF.count());
+
+        // compare distances, a tie may be taken on either side
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            if (std::abs(test[i] - vec[resL[i]].second) == std::abs(test[i] - vec[resF[i]].second))
+                continue;
+
+            mismatch() << test[i] << " \t" << vec[resL[i]].second << "\t\t" << vec[resF[i]].second << std::endl;
+        }
+    }
+
+    savePlot("testJoin.png", "Comparison of lookups and join", {gr_lookup, gr_join}, "Number of values", "Time, #muS", true, false);
+}
+
+void testRebuild(bool verbose)
+{
+    // create randomer: one small event after another, a new container per event against one container
+    // rebuilt from a reused input buffer
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_new = makeGraph("gr_new", "New container", kRed);
+    TGraph* gr_reuse = makeGraph("gr_reuse", "Rebuild", kBlue);
+
+    int max_pow = 15;
+    int nEvents = 1000;
+
+    for (int ipow = 4; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::vector<std::pair<int, double>>> events(nEvents);
+        for (auto& vec: events)
+        {
+            vec.reserve(N);
+            for (int i=0; i<N; i++)
+                vec.emplace_back(i, udist(gen));
+        }
+
+        // TEST NEW CONTAINERS
+        std::vector<int> resNew;
+        resNew.reserve(nEvents);
+        auto startNew = std::chrono::high_resolution_clock::now();
+        for (const auto& vec: events)
+        {
+            FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+            fc.set(vec);
+            resNew.push_back(*fc.getClosestId(0).first);
+        }
+        auto stopNew = std::chrono::high_resolution_clock::now();
+        auto durationNew = std::chrono::duration_cast<std::chrono::microseconds>(stopNew - startNew);
+        if (verbose) std::cout << "New duration: " << durationNew.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        std::vector<int> resF;
+        resF.reserve(nEvents);
+        FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+        std::vector<std::pair<int, double>> buffer;
+        buffer.reserve(N);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const auto& vec: events)
+        {
+            buffer.assign(vec.begin(), vec.end());
+            fc.set(std::move(buffer));
+            resF.push_back(*fc.getClosestId(0).first);
+        }
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "Rebuild duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_new->AddPoint(N, durationNew.count());
+        gr_reuse->AddPoint(N, durationF.count());
+
+        // compare solutions
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < nEvents; i++)
+        {
+            if (resNew[i] == resF[i])
+                continue;
+
+            mismatch() << i << " \t" << resNew[i] << "\t\t" << resF[i] << std::endl;
+        }
+    }
+
+    savePlot("testRebuild.png", "Comparison of new containers and rebuilds", {gr_new, gr_reuse}, "Number of values", "Time, #muS", true, true);
+}
+
+void testWideCells(bool verbose)
+{
+    // create randomer: cells of 5 values searched by the scalar kernel against cells of 8 values searched
+    // by the SIMD kernels, one compare per cell with AVX-512
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_scalar = makeGraph("gr_scalar", "Scalar, 5 values", kRed);
+    TGraph* gr_simd = makeGraph("gr_simd", "SIMD, 8 values", kBlue);
+
+    int max_pow = 23;
+    int testN = 1e6;
+    const SimdLevel level = getSimdLevel();
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        FastContainer<double> fc(-200, 200, Bucketing::Quantile);
+        fc.set(vec);
+        FastContainer<double, int, 8> wide(-200, 200, Bucketing::Quantile);
+        wide.set(vec);
+
+        // TEST SCALAR KERNEL
+        setSimdLevel(SimdLevel::Scalar);
+        std::vector<int> resS;
+        resS.reserve(testN);
+        auto startS = std::chrono::high_resolution_clock::now();
+        for (const double z: test)
+            resS.push_back(*fc.getClosestId(z).first);
+        auto stopS = std::chrono::high_resolution_clock::now();
+        auto durationS = std::chrono::duration_cast<std::chrono::microseconds>(stopS - startS);
+        if (verbose) std::cout << "Scalar duration: " << durationS.count() << ", muSec" << std::endl;
+
+        // TEST NEW SOLUTION
+        setSimdLevel(level);
+        std::vector<int> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const double z: test)
+            resF.push_back(*wide.getClosestId(z).first);
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+        if (verbose) std::cout << "SIMD duration: " << durationF.count() << ", muSec" << std::endl;
+
+        gr_scalar->AddPoint(N, durationS.count());
+        gr_simd->AddPoint(N, durationF.count());
+
+        // compare distances, a tie may be taken on either side
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            if (std::abs(test[i] - vec[resS[i]].second) == std::abs(test[i] - vec[resF[i]].second))
+                continue;
+
+            mismatch() << test[i] << " \t" << vec[resS[i]].second << "\t\t" << vec[resF[i]].second << std::endl;
+        }
+    }
+
+    savePlot("testWideCells.png", "Comparison of scalar and SIMD cells", {gr_scalar, gr_simd}, "Number of values", "Time, #muS", true, false);
+}
+
+void testQuantized(bool verbose)
+{
+    // create randomer: the same uniform cells with full precision values and with 16 bit codes
+    std::mt19937 gen = makeGenerator();
+    std::uniform_real_distribution<> udist(-200.0, 200.0);
+
+    TGraph* gr_fast = makeGraph("gr_fast", "FastContainer", kBlue);
+    TGraph* gr_quantized = makeGraph("gr_quantized", "QuantizedFastContainer", kRed);
+
+    TGraph* gr_mem_fast = makeGraph("gr_mem_fast", "FastContainer", kBlue);
+    TGraph* gr_mem_quantized = makeGraph("gr_mem_quantized", "QuantizedFastContainer", kRed);
+
+    int max_pow = 18;
+    int testN = 1e6;
+
+    for (int ipow = 1; ipow < max_pow; ++ipow)
+    {
+        // generate and fill input data
+        int N = pow(2, ipow);
+        std::cout << "Input number: " << N << std::endl;
+        std::vector<std::pair<int, double>> vec;
+        vec.reserve(N);
+        for (int i=0; i<N; i++)
+            vec.emplace_back(i, udist(gen));
+
+        // generate test numbers
+        std::cout << "Test number: " << testN << std::endl;
+        std::vector<double> test;
+        test.reserve(testN);
+        for (int i = 0; i<testN; i++)
+            test.push_back(udist(gen));
+
+        FastContainer<double> fc(-200, 200);
+        fc.set(vec);
+        std::vector<int> resF;
+        resF.reserve(testN);
+        auto startF = std::chrono::high_resolution_clock::now();
+        for (const auto& elem: test)
+            resF.push_back(*(fc.getClosestId(elem).first));
+        auto stopF = std::chrono::high_resolution_clock::now();
+        auto durationF = std::chrono::duration_cast<std::chrono::microseconds>(stopF - startF);
+
+        QuantizedFastContainer<double> qfc(-200, 200);
+        qfc.set(vec);
+        std::vector<int> resQ;
+        resQ.reserve(testN);
+        auto startQ = std::chrono::high_resolution_clock::now();
+        for (const auto& elem: test)
+            resQ.push_back(*(qfc.getClosestId(elem).first));
+        auto stopQ = std::chrono::high_resolution_clock::now();
+        auto durationQ = std::chrono::duration_cast<std::chrono::microseconds>(stopQ - startQ);
+
+        const double memF = double(fc.getMemoryUsage()) / N;
+        const double memQ = double(qfc.getMemoryUsage()) / N;
+        if (verbose){
+            std::cout << "New duration: " << durationF.count() << ", muSec" << std::endl;
+            std::cout << "Quantized duration: " << durationQ.count() << ", muSec" << std::endl;
+            std::cout << "Memory per point: " << memF << " vs " << memQ << " quantized, bytes" << std::endl;
+        }
+
+        gr_fast->AddPoint(N, durationF.count());
+        gr_quantized->AddPoint(N, durationQ.count());
+        gr_mem_fast->AddPoint(N, memF);
+        gr_mem_quantized->AddPoint(N, memQ);
+
+        // compare distances, the codes must give the exact nearest value
+        if (verbose) std::cout << "Check solutions" << std::endl;
+        for (int i = 0; i < testN; i++)
+        {
+            if (std::abs(vec.at(resF.at(i)).second - test.at(i)) == std::abs(vec.at(resQ.at(i)).second - test.at(i)))
+                continue;
+
+            mismatch() << test.at(i) << " \t" << resF.at(i) << " " << vec.at(resF.at(i)).second << std::endl;
+            std::cout << "\t\t" << resQ.at(i) << " " << vec.at(resQ.at(i)).second << std::endl;
+        }
+    }
+
+    savePlot("testQuantized.png", "Comparison getNearest, quantized cells", {gr_fast, gr_quantized}, "Number of values", "Time, #muS", false, true);
+
+    savePlot("testQuantizedMemory.png", "Memory per point", {gr_mem_fast, gr_mem_quantized}, "Number of values", "Bytes per point", false, true);
+}
+
 int main()
 {
     testNearest(false);
     testRanges(false);
-    return 0;
+    testBatchNearest(false);
+    testClustered(false);
+    testUpdates(false);
+    testBuild(false);
+    testIntegerKeys(false);
+    testCompact(false);
+    testKClosest(false);
+    testND(false);
+    testConcurrent(false);
+    testMapped(false);
+    testStreaming(false);
+    testAggregates(false);
+    testStats(false);
+    testMultiRanges(false);
+    testKernel(false);
+    testBulk(false);
+    testSharded(false);
+    testTuning(false);
+    testPayload(false);
+    testJoin(false);
+    testRebuild(false);
+    testWideCells(false);
+    testQuantized(false);
+    if (nMismatches > 0)
+        std::cout << nMismatches << " mismatches" << std::endl;
+    return nMismatches > 0 ? 1 : 0;
 }